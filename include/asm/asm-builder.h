@@ -1,6 +1,7 @@
 #ifndef BDDD_ASM_BUILDER_H
 #define BDDD_ASM_BUILDER_H
 
+#include <map>
 #include <stack>
 #include <unordered_map>
 
@@ -19,6 +20,13 @@ public:
       m_block_map;
   std::unordered_map<std::shared_ptr<Value>, std::shared_ptr<Operand>>
       m_load_map;
+  // (dividend, devisor) -> quotient computed in current block
+  std::map<std::pair<std::shared_ptr<Value>, std::shared_ptr<Value>>,
+           std::shared_ptr<Operand>>
+      m_div_map;
+  // global name -> its address, loaded once in the entry block by the order
+  // of the names, so that the output doesn't depend on hashing
+  std::map<std::string, std::shared_ptr<LDRInst>> m_global_map;
 
   ASM_Builder(std::shared_ptr<ASM_Module> m);
 
@@ -32,6 +40,10 @@ public:
 
   void setParams();
 
+  // the registers of the params by AAPCS-VFP, nullptr for those on the stack
+  std::vector<std::shared_ptr<Operand>> getParamRegs(
+      const std::vector<std::shared_ptr<Value>>& params);
+
   void fixedStackParams();
 
   void appendBlock(std::shared_ptr<ASM_BasicBlock> block);
@@ -83,7 +95,8 @@ public:
                                  CondType cond);
 
   // appendCALL
-  std::shared_ptr<CALLInst> appendCALL(VarType type, std::string label, int n);
+  std::shared_ptr<CALLInst> appendCALL(VarType type, std::string label, int n,
+                                       int f_n = 0);
 
   // appendShift
   std::shared_ptr<ShiftInst> appendShift(InstOp op,
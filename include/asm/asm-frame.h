@@ -0,0 +1,14 @@
+#ifndef BDDD_ASM_FRAME_H
+#define BDDD_ASM_FRAME_H
+
+#include "asm/asm.h"
+
+void markTailCalls(std::shared_ptr<ASM_Function> func);
+
+void markTailCalls(std::shared_ptr<ASM_Module> module);
+
+void shrinkWrap(std::shared_ptr<ASM_Function> func);
+
+void shrinkWrap(std::shared_ptr<ASM_Module> module);
+
+#endif  // BDDD_ASM_FRAME_H
@@ -0,0 +1,23 @@
+#ifndef BDDD_ASM_LAYOUT_H
+#define BDDD_ASM_LAYOUT_H
+
+#include "asm/asm.h"
+
+// estimates without a profile: a branch stays in its loop with
+// LAYOUT_LOOP_PROB, goes to a block that only returns with LAYOUT_RETURN_PROB
+#define LAYOUT_LOOP_PROB 0.9
+#define LAYOUT_RETURN_PROB 0.3
+
+// estimated iterations of a loop each time it is entered
+#define LAYOUT_LOOP_WEIGHT 10
+
+// loop headers are aligned to 1 << LOOP_ALIGN bytes, unless that takes more
+// than LOOP_ALIGN_MAX_SKIP bytes of padding
+#define LOOP_ALIGN 4
+#define LOOP_ALIGN_MAX_SKIP 8
+
+void layoutBlocks(std::shared_ptr<ASM_Function> func);
+
+void layoutBlocks(std::shared_ptr<ASM_Module> module);
+
+#endif  // BDDD_ASM_LAYOUT_H
@@ -3,6 +3,10 @@
 
 #include "asm/asm.h"
 
+// max predicated instructions replacing a branch, a mispredicted branch costs
+// about 8 cycles on Cortex-A7/A53
+#define IF_CONVERSION_LIMIT 4
+
 void eliminateRedundantMOV(std::shared_ptr<ASM_Module> module);
 
 void eliminateRedundantJump(std::shared_ptr<ASM_Module> module);
@@ -14,16 +18,25 @@ void removeUnreachableBlock(std::shared_ptr<ASM_Module> module);
 
 void combineInstruction(std::shared_ptr<ASM_Module> module);
 
-std::shared_ptr<ASM_Instruction> combineMULToADD(std::shared_ptr<MULInst> mul,
-                                                 std::shared_ptr<ASInst> as);
-
 std::shared_ptr<ASM_Instruction> combineShiftToADD(
     std::shared_ptr<ShiftInst> shift_inst, std::shared_ptr<ASInst> as);
 
+void combineAddressing(std::shared_ptr<ASM_Module> module);
+
+std::shared_ptr<ASM_Instruction> combineADDToAddr(
+    std::shared_ptr<ASInst> add, std::shared_ptr<ASM_Instruction> mem);
+
 void eliminateDeadInstruction(std::shared_ptr<ASM_Module> module);
 
+int countPredicable(std::shared_ptr<ASM_BasicBlock> block);
+
+void predicateBlock(std::shared_ptr<ASM_BasicBlock> block,
+                    std::shared_ptr<ASM_BasicBlock> head, CondType cond);
+
+void ifConversion(std::shared_ptr<ASM_Module> module);
+
 void optimizeTemp(std::shared_ptr<ASM_Module> module, bool optimization);
 
-void optimize(std::shared_ptr<ASM_Module> module);
+void optimize(std::shared_ptr<ASM_Module> module, bool optimization);
 
 #endif  // BDDD_ASM_OPTIMIZATION_H
\ No newline at end of file
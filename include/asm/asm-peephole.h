@@ -0,0 +1,29 @@
+#ifndef BDDD_ASM_PEEPHOLE_H
+#define BDDD_ASM_PEEPHOLE_H
+
+#include <unordered_set>
+
+#include "asm/asm.h"
+
+// instructions a pattern looks ahead for the rest of its match
+#define PEEPHOLE_WINDOW 16
+
+typedef std::list<std::shared_ptr<ASM_Instruction>>::iterator InstIter;
+
+// registers by number and virtual registers by identity
+typedef std::unordered_set<uintptr_t> RegSet;
+
+// rewrite the instructions starting at iter, true if it did
+typedef bool (*PeepholeRule)(std::shared_ptr<ASM_BasicBlock> block,
+                             InstIter iter, const RegSet& live_out);
+
+struct PeepholePattern {
+  const char* m_name;
+  bool m_pre_ra;
+  bool m_post_ra;
+  PeepholeRule m_rule;
+};
+
+void peephole(std::shared_ptr<ASM_Module> module, bool post_ra);
+
+#endif  // BDDD_ASM_PEEPHOLE_H
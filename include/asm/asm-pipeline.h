@@ -0,0 +1,22 @@
+#ifndef BDDD_ASM_PIPELINE_H
+#define BDDD_ASM_PIPELINE_H
+
+#include "asm/asm.h"
+
+// largest loop (body and head) considered for software pipelining, the loop
+// is emitted about three times
+#define PIPELINE_MAX_INSTS 64
+
+// tries of the iterative modulo scheduler per instruction before giving up
+// an initiation interval
+#define PIPELINE_BUDGET 8
+
+std::shared_ptr<ASM_Instruction> cloneInstruction(
+    std::shared_ptr<ASM_Instruction> inst);
+
+bool pipelineLoop(std::shared_ptr<ASM_Function> func,
+                  std::shared_ptr<ASM_BasicBlock> body);
+
+void pipelineLoops(std::shared_ptr<ASM_Module> module);
+
+#endif  // BDDD_ASM_PIPELINE_H
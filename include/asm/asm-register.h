@@ -10,6 +10,26 @@
 
 typedef std::shared_ptr<Operand> OpPtr;
 
+// estimated executions of a block per loop level around it
+#define SPILL_LOOP_WEIGHT 10
+
+// a reloaded or stored spilled value is reused by later uses in the same
+// block at most this many instructions away, instead of being reloaded
+#define SPILL_REUSE_DISTANCE 6
+
+// a spilled value that can be recomputed costs an instruction per use instead
+// of a store and a load per use
+#define SPILL_REMAT_WEIGHT 0.5
+
+// functions with more values than this are allocated by linear scan, which
+// is much faster than coloring on large straight-line code
+#define LINEAR_SCAN_THRESHOLD 3000
+
+// executions of block per call of func, by the profile if there is one and
+// by SPILL_LOOP_WEIGHT for each loop around it otherwise
+double getBlockWeight(std::shared_ptr<ASM_Function> func,
+                      std::shared_ptr<ASM_BasicBlock> block);
+
 class OpPairHash {
 public:
   size_t operator()(const std::pair<OpPtr, OpPtr>& p) const {
@@ -27,8 +47,17 @@ private:
   std::set<RReg> rreg_avaliable;
   std::set<SReg> sreg_avaliable;
   int K;
-
-  std::unordered_map<OpPtr, int> m_depth_map;
+  // allocate every function by linear scan
+  bool m_linear_scan;
+
+  // uses and defs weighted by the loop depth of their blocks
+  std::unordered_map<OpPtr, double> m_spill_cost;
+  // temporaries created by spilling, never chosen again if possible
+  std::unordered_set<OpPtr> m_spill_temps;
+  // values split from the same one share a stack slot
+  std::unordered_map<OpPtr, int> m_split_slot;
+  // the only definition of a value, nullptr if it can't be recomputed
+  std::unordered_map<OpPtr, std::shared_ptr<ASM_Instruction>> m_remat_def;
 
   void setCurFunction(std::shared_ptr<ASM_Function> func);
 
@@ -104,6 +133,10 @@ private:
 
   void SelectSpill();
 
+  double getSpillCost(OpPtr n);
+
+  int EvictNeighbors(OpPtr n);
+
   void AssignColors();
 
   void AssignColorsR();
@@ -122,11 +155,17 @@ private:
 
   void getInitial();
 
-  // taken from tinbaccc
-  void updateDepth(std::shared_ptr<ASM_BasicBlock> block, OpPtr node);
+  void addSpillCost(std::shared_ptr<ASM_BasicBlock> block, OpPtr node);
+
+  bool Rematerialize(OpPtr v, std::unordered_set<OpPtr>& new_temps);
+
+  void LinearScanCurFunc();
+
+  bool LinearScan();
 
 public:
-  RegisterAllocator(std::shared_ptr<ASM_Module> module, RegType type);
+  RegisterAllocator(std::shared_ptr<ASM_Module> module, RegType type,
+                    bool linear_scan = false);
 
   void Allocate();
 
@@ -0,0 +1,31 @@
+#ifndef BDDD_ASM_SCHEDULE_H
+#define BDDD_ASM_SCHEDULE_H
+
+#include "asm/asm.h"
+
+// latency (cycles) of a Cortex-A7/A53 class in-order core
+#define MOV_LATENCY 1
+#define ALU_LATENCY 1
+#define ALU_SHIFT_LATENCY 2
+#define MUL_LATENCY 3
+#define SMMUL_LATENCY 4
+#define SDIV_LATENCY 12
+#define LOAD_LATENCY 3
+#define VMOV_LATENCY 2
+#define VFP_LATENCY 4
+#define VMLA_LATENCY 8
+#define VDIV_LATENCY 18
+
+// live values above which the pre-RA scheduler stops hiding latency and
+// prefers instructions that end live ranges, a bit below the number of
+// allocatable registers
+#define SCHEDULE_PRESSURE_R 12
+#define SCHEDULE_PRESSURE_S 28
+
+int getLatency(std::shared_ptr<ASM_Instruction> inst);
+
+void scheduleBlock(std::shared_ptr<ASM_BasicBlock> block, bool post_ra);
+
+void scheduleInstruction(std::shared_ptr<ASM_Module> module, bool post_ra);
+
+#endif  // BDDD_ASM_SCHEDULE_H
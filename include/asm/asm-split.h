@@ -0,0 +1,18 @@
+#ifndef BDDD_ASM_SPLIT_H
+#define BDDD_ASM_SPLIT_H
+
+#include "asm/asm.h"
+
+// allocatable registers, more values live at once in a loop can't be colored
+#define SPLIT_PRESSURE_R 14
+#define SPLIT_PRESSURE_S 32
+
+// callee-saved registers, the only ones left to values live across a call
+#define SPLIT_CALL_PRESSURE_R 8
+#define SPLIT_CALL_PRESSURE_S 16
+
+void splitLiveRanges(std::shared_ptr<ASM_Function> func, RegType reg_type);
+
+void splitLiveRanges(std::shared_ptr<ASM_Module> module);
+
+#endif  // BDDD_ASM_SPLIT_H
@@ -0,0 +1,14 @@
+#ifndef BDDD_ASM_STACK_H
+#define BDDD_ASM_STACK_H
+
+#include "asm/asm.h"
+
+// unused bytes allowed between the spill slots and the locals moved above
+// them, to keep the offsets of the locals encodable
+#define STACK_PAD_LIMIT 256
+
+void colorStackSlots(std::shared_ptr<ASM_Function> func);
+
+void colorStackSlots(std::shared_ptr<ASM_Module> module);
+
+#endif  // BDDD_ASM_STACK_H
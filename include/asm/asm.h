@@ -77,6 +77,10 @@ enum class InstOp {
   MOV,
   PUSH,
   POP,
+  LDRD,
+  STRD,
+  LDM,
+  STM,
   // branch instructions
   B,
   BL,
@@ -120,6 +124,8 @@ enum class InstOp {
   VSTR,
   VPUSH,
   VPOP,
+  VLDM,
+  VSTM,
   // convert between integer and float
   VCVT
 };
@@ -211,9 +217,13 @@ class ASM_Module {
 public:
   std::list<std::shared_ptr<ASM_Function>> m_funcs;
   std::shared_ptr<Module> m_ir_module;
+  // the file the block counters are written to, empty if not instrumented
+  std::string m_profile_path;
 
   void exportGlobalVar(std::ofstream& ofs);
 
+  void exportProfileDump(std::ofstream& ofs);
+
   template <class T>
   void exportVarBody(std::ofstream& ofs, std::shared_ptr<T> init_val);
 
@@ -235,6 +245,16 @@ public:
   std::unordered_map<std::shared_ptr<ASM_Instruction>,
                      std::list<std::shared_ptr<ASM_Instruction>>::iterator>
       m_params_pos_map;
+  // values renamed by live-range splitting, and the value they were split from
+  std::unordered_map<std::shared_ptr<Operand>, std::shared_ptr<Operand>>
+      m_split_from;
+  // spill code, and the offset of the stack slot it accesses
+  std::unordered_map<std::shared_ptr<ASM_Instruction>, int> m_spill_slots;
+  // the frame is set up in m_frame_block instead of the entry if it is set,
+  // returns that skip it go to m_fast_rblock
+  std::shared_ptr<ASM_BasicBlock> m_frame_block;
+  std::shared_ptr<ASM_BasicBlock> m_fast_rblock;
+  bool m_frameless;
   int m_params_size;
   int m_local_alloc;
   std::stack<int> m_sp_alloc_size;
@@ -243,6 +263,7 @@ public:
       : m_ir_func(ir_func),
         m_name(ir_func->FuncName()),
         m_rblock(std::make_shared<ASM_BasicBlock>()),
+        m_frameless(false),
         m_local_alloc(0),
         m_push(std::make_unique<PInst>(InstOp::PUSH)),
         m_pop(std::make_unique<PInst>(InstOp::POP)),
@@ -261,6 +282,11 @@ public:
 
   void appendPop(std::shared_ptr<Operand> reg);
 
+  std::shared_ptr<ASM_BasicBlock> splitEdge(
+      std::shared_ptr<ASM_BasicBlock> from, std::shared_ptr<ASM_BasicBlock> to);
+
+  void lowerPhiCopies();
+
   void exportASM(std::ofstream& ofs);
 };
 
@@ -270,9 +296,15 @@ public:
   std::string m_label;
   std::list<std::shared_ptr<ASM_Instruction>> m_insts;
   std::list<std::shared_ptr<ASM_Instruction>>::iterator m_branch_pos;
-  std::list<std::shared_ptr<ASM_Instruction>> m_mov_filled_list;
+  // (dest, src) of the phis of each successor, copied in parallel on the edge
+  std::unordered_map<std::shared_ptr<ASM_BasicBlock>,
+                     std::vector<std::pair<std::shared_ptr<Operand>,
+                                           std::shared_ptr<Operand>>>>
+      m_phi_copies;
 
   int m_loop_depth;
+  // executions of the block by the profile, -1 without one
+  double m_frequency;
 
   std::unordered_set<std::shared_ptr<Operand>> m_def;
   std::unordered_set<std::shared_ptr<Operand>> m_use;
@@ -283,6 +315,7 @@ public:
 
   ASM_BasicBlock(int depth = 0)
       : m_loop_depth(depth),
+        m_frequency(-1),
         m_branch_pos(m_insts.end()),
         m_label(".L" + std::to_string(block_id++)) {}
 
@@ -302,9 +335,9 @@ public:
 
   void insertPhiMOV(std::shared_ptr<ASM_Instruction> mov);
 
-  void appendFilledMOV(std::shared_ptr<ASM_Instruction> mov);
-
-  void fillMOV();
+  void appendPhiCopy(std::shared_ptr<ASM_BasicBlock> succ,
+                     std::shared_ptr<Operand> dest,
+                     std::shared_ptr<Operand> src);
 
   void appendSuccessor(std::shared_ptr<ASM_BasicBlock> succ);
 
@@ -344,6 +377,7 @@ public:
   int m_params_offset;
   bool m_is_mov;  // for register allocation
   bool m_is_deleted;
+  bool m_is_spill;  // a load or store of a spill slot
 
   std::shared_ptr<ASM_BasicBlock> m_block;
   std::unordered_set<std::shared_ptr<Operand>> m_def;
@@ -355,7 +389,8 @@ public:
       : m_set_flag(false),
         m_params_offset(0),
         m_is_mov(false),
-        m_is_deleted(false) {}
+        m_is_deleted(false),
+        m_is_spill(false) {}
 
   std::string getOpName();
 
@@ -461,6 +496,26 @@ public:
                   std::shared_ptr<Operand> oldOp) override;
 };
 
+// LDRD STRD LDM STM VLDM VSTM, the registers are loaded from or stored to
+// consecutive words from base + offs
+class LSMInst : public ASM_Instruction {
+public:
+  std::vector<std::shared_ptr<Operand>> m_regs;
+  std::shared_ptr<Operand> m_base;
+  int m_offs;
+
+  LSMInst(InstOp op, std::vector<std::shared_ptr<Operand>> regs,
+          std::shared_ptr<Operand> base, int offs);
+
+  void exportASM(std::ofstream& ofs) override;
+
+  void replaceDef(std::shared_ptr<Operand> newOp,
+                  std::shared_ptr<Operand> oldOp) override;
+
+  void replaceUse(std::shared_ptr<Operand> newOp,
+                  std::shared_ptr<Operand> oldOp) override;
+};
+
 class BInst : public ASM_Instruction {
 public:
   std::shared_ptr<ASM_BasicBlock> m_target;
@@ -483,9 +538,13 @@ public:
 
   std::string m_label;
 
+  // int and float params
   int m_params;
+  int m_f_params;
+  // the frame is torn down and the callee returns for the caller
+  bool m_is_tail;
 
-  CALLInst(VarType t, std::string l, int n);
+  CALLInst(VarType t, std::string l, int n, int f_n = 0);
 
   void exportASM(std::ofstream& ofs) override;
 
@@ -634,21 +693,6 @@ public:
                   std::shared_ptr<Operand> oldOp) override;
 };
 
-class POOLInst : public ASM_Instruction {
-public:
-  int m_number;
-
-  POOLInst(int number) : m_number(number) {}
-
-  void exportASM(std::ofstream& ofs) override;
-
-  void replaceDef(std::shared_ptr<Operand> newOp,
-                  std::shared_ptr<Operand> oldOp) override {}
-
-  void replaceUse(std::shared_ptr<Operand> newOp,
-                  std::shared_ptr<Operand> oldOp) override {}
-};
-
 class VNEGInst : public ASM_Instruction {
 public:
   std::shared_ptr<Operand> m_dest;
@@ -0,0 +1,70 @@
+#ifndef BDDD_IR_INTERPRETER_H
+#define BDDD_IR_INTERPRETER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "ir/builder.h"
+
+// every value of the IR fits in 32 bits, pointers are offsets in m_memory
+union IRWord {
+  int m_int;
+  float m_float;
+};
+
+// runs the IR of a module on the host, for the dynamic instruction counts
+// without an ARM machine. the builtins read stdin and write stdout like sylib
+class IRInterpreter {
+private:
+  // a function prepared for running: every value read or written has a slot
+  // in the frame, the constants and global addresses are filled in init
+  struct FunctionInfo {
+    std::unordered_map<Value *, int> m_value_slots;
+    std::unordered_map<Use *, int> m_use_slots;
+    std::vector<IRWord> m_init;
+    std::unordered_map<BasicBlock *, int> m_block_index;
+    std::vector<uint64_t> m_block_counts;
+    uint64_t m_calls;
+  };
+
+  std::shared_ptr<IRBuilder> m_builder;
+  std::unordered_map<Function *, FunctionInfo> m_infos;
+  std::unordered_map<GlobalVariable *, int> m_global_addrs;
+  std::vector<uint8_t> m_memory;
+  int m_sp;  // allocas grow up from the globals
+
+  uint64_t m_instructions;  // dynamic count of IR instructions
+  // _sysy_starttime to _sysy_stoptime, (start line, stop line, instructions)
+  int m_timer_line;
+  uint64_t m_timer_start;
+  std::vector<std::tuple<int, int, uint64_t>> m_timers;
+
+  FunctionInfo &GetInfo(Function *func);
+  int GetSlot(FunctionInfo &info, Value *value);
+
+  IRWord Call(Function *func, const std::vector<IRWord> &args);
+  IRWord CallBuiltin(const std::string &name, const std::vector<IRWord> &args);
+
+  int Load(int addr);
+  void Store(int addr, int val);
+  void CheckAddress(int addr, int size);
+
+public:
+  explicit IRInterpreter(std::shared_ptr<IRBuilder> builder);
+
+  // runs main, returns its exit code
+  int Run();
+
+  // instructions run by each function and each of its blocks
+  void Report(std::ostream &os);
+
+  // the block counts in the format of -fprofile-use, the IR must be the one
+  // just generated
+  void WriteProfile(const std::string &path);
+};
+
+#endif  // BDDD_IR_INTERPRETER_H
@@ -3,6 +3,11 @@
 
 #include "ir/builder.h"
 
+// the block counters of -fprofile-generate, and the function writing them to
+// the profile when main returns
+#define PROFILE_COUNTS "__bddd_profile_counts"
+#define PROFILE_DUMP "__bddd_profile_dump"
+
 // auxiliary
 void ComputeDominanceRelationship(std::shared_ptr<Function> function);
 void ComputeDominanceFrontier(std::shared_ptr<Function> function);
@@ -47,6 +52,14 @@ public:
   void InstrCombiningPass();
 
   void LoopSimplifyPass();
+
+  void SelectFormationPass();
+
+  // must run on the IR right after it is generated, so that the blocks are
+  // numbered the same when the profile is read back
+  void ProfileGeneratePass();
+
+  bool ProfileUsePass(const std::string &path);
 };
 
 #endif  // BDDD_IR_PASS_MANAGER_H
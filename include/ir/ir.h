@@ -51,6 +51,7 @@ enum class IROp {
   STORE,
   GET_ELEMENT_PTR,
   PHI,
+  SELECT,  // i1 ? x : y, formed from small diamonds
 
   BITCAST,
   // extensions
@@ -350,6 +351,14 @@ public:
         m_is_float(decl->GetVarType() == VarType::FLOAT),
         m_is_array(decl->IsArray()) {}
 
+  // a variable made by the compiler instead of declared in the source
+  explicit GlobalVariable(std::string name, bool is_float, bool is_array)
+      : Value(is_float, is_array),
+        m_name(std::move(name)),
+        m_is_const(false),
+        m_is_float(is_float),
+        m_is_array(is_array) {}
+
   // void AllocateName(std::shared_ptr<IRNameAllocator> allocator) override;
   virtual EvalValue GetFlattenVal(int offset) = 0;
 };
@@ -377,6 +386,14 @@ public:
     m_type.Set(BasicType::INT, std::move(dimensions), true);
   }
 
+  // zero-initialized array of size ints
+  explicit IntGlobalVariable(std::string name, int size)
+      : GlobalVariable(std::move(name), false, true),
+        m_flatten_vals(size, 0),
+        m_is_array(true) {
+    m_type.Set(BasicType::INT, std::vector<int>{size}, true);
+  }
+
   void ExportIR(std::ofstream &ofs, int depth) override;
 
   EvalValue GetFlattenVal(int offset) override;
@@ -896,6 +913,37 @@ public:
   }
 };
 
+// %r = select i1 %cond, T %x, T %y
+// the condition must be a comparison (maybe negated by xor)
+class SelectInstruction : public Instruction {
+public:
+  Use *m_cond;
+  Use *m_true_val;
+  Use *m_false_val;
+
+  explicit SelectInstruction(ValueType type, std::shared_ptr<BasicBlock> bb)
+      : Instruction(IROp::SELECT, std::move(bb)),
+        m_cond(nullptr),
+        m_true_val(nullptr),
+        m_false_val(nullptr) {
+    m_type = std::move(type);
+  }
+
+  void ExportIR(std::ofstream &ofs, int depth) override;
+  bool IsTerminator() override { return false; }
+  std::vector<Use *> Operands() override {
+    return {m_cond, m_true_val, m_false_val};
+  }
+  void KillAllMyUses() override {
+    m_cond->m_value.lock()->KillUse(m_cond);
+    m_cond = nullptr;
+    m_true_val->m_value.lock()->KillUse(m_true_val);
+    m_true_val = nullptr;
+    m_false_val->m_value.lock()->KillUse(m_false_val);
+    m_false_val = nullptr;
+  }
+};
+
 // fat pointer to thin pointer
 // i32* to i8*, float* to i8*
 class BitCastInstruction : public Instruction {
@@ -999,6 +1047,7 @@ public:
   int m_dom_depth;   // depth in dominance tree
   int m_dfs_depth;   // computed in rpo dfs
   int m_loop_depth;  // depth in loop (see ComputeLoopInfo)
+  double m_frequency;  // executions in the profile run, -1 without a profile
 
   bool m_visited;  // first used in mem2reg
   std::unordered_set<std::shared_ptr<BasicBlock>> m_predecessors;
@@ -1015,6 +1064,7 @@ public:
         m_dom_depth(-1),
         m_dfs_depth(-1),
         m_loop_depth(-1),
+        m_frequency(-1),
         m_visited(false) {}
 
   void PushBackInstruction(std::shared_ptr<Instruction> instr);
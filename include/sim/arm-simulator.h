@@ -0,0 +1,174 @@
+#ifndef BDDD_ARM_SIMULATOR_H
+#define BDDD_ARM_SIMULATOR_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "asm/asm-schedule.h"
+
+// a taken branch refetches, the pipeline is in order and issues one
+// instruction per cycle, otherwise it waits for the operands by the
+// latencies of asm-schedule.h, LDM and the like move two words a cycle
+#define TAKEN_BRANCH_PENALTY 1
+
+// the stack above the data, the program fails if it grows beyond
+#define SIM_STACK_SIZE (64 << 20)
+
+// the mnemonics bddd exports, the ASM_Instruction ones and those only
+// written by the exporter (MOVW MOVT BX SVC VMRS)
+enum class SimOp {
+  // data instructions
+  LDR,
+  STR,
+  LDRD,
+  STRD,
+  LDM,
+  STM,
+  MOV,
+  MOVW,
+  MOVT,
+  MVN,
+  PUSH,
+  POP,
+  // branch instructions
+  B,
+  BL,
+  BX,
+  SVC,
+  // shift instructions
+  LSL,
+  LSR,
+  ASR,
+  ROR,
+  // arithmetic instructions
+  ADD,
+  SUB,
+  RSB,
+  MLA,
+  MLS,
+  MUL,
+  SMMLA,
+  SMMLS,
+  SMMUL,
+  SDIV,
+  // bitwise and compare instructions
+  AND,
+  ORR,
+  EOR,
+  BIC,
+  CMP,
+  TST,
+  // floating-point instructions
+  VMOV,
+  VADD,
+  VSUB,
+  VMLA,
+  VMLS,
+  VMUL,
+  VDIV,
+  VNEG,
+  VCMP,
+  VMRS,
+  VLDR,
+  VSTR,
+  VPUSH,
+  VPOP,
+  VLDM,
+  VSTM,
+  VCVT
+};
+
+// runs the assembly bddd exports on the host, with a cost model of an
+// in-order core, to compare the code of backend changes. the sylib
+// functions read stdin and write stdout, the program's output goes there
+class ARMSimulator {
+private:
+  // registers are numbered R0-R15 then S0-S31, the flags come after
+  static constexpr int FLAGS = 48;
+  static constexpr int FPSCR = 49;
+  static constexpr int REG_NUM = 50;
+
+  struct SimInst {
+    SimOp m_op;
+    CondType m_cond;
+    bool m_set_flag;
+    bool m_is_spill;  // marked by the exporter
+    // destination and sources, -1 if absent. m_imm is used if m_rm is -1
+    int m_rd, m_rn, m_rm, m_ra;
+    int m_imm;
+    SimOp m_shift;  // LSL LSR ASR ROR of m_rm, by m_shift_amt or m_rs
+    int m_shift_amt, m_rs;
+    bool m_has_shift;
+    int m_mode;  // LDM STM: 0 IA, 1 IB, -1 DB. VCVT: 1 to float
+    std::vector<int> m_regs;
+    int m_target;  // B BL: index of the instruction, -1 for a sylib call
+    std::string m_label;
+
+    std::vector<int> m_srcs, m_dsts;
+    int m_latency, m_issue;
+    int m_block;
+  };
+
+  struct SimBlock {
+    std::string m_label, m_func;
+    int m_begin, m_end;
+  };
+
+  std::vector<SimInst> m_insts;
+  std::vector<SimBlock> m_blocks;
+  std::unordered_map<std::string, int> m_text_labels;
+  std::unordered_map<std::string, int> m_data_labels;
+  std::vector<uint8_t> m_memory;
+  int m_data_end;
+
+  uint32_t m_regs[REG_NUM];
+  uint64_t m_ready[REG_NUM];
+  bool m_n, m_z, m_c, m_v;
+  bool m_fn, m_fz, m_fc, m_fv;
+
+  // files opened by the profile dump of -fprofile-generate
+  std::unordered_map<int, std::string> m_files;
+
+  uint64_t m_cycles, m_steps;
+  uint64_t m_loads, m_stores, m_spill_loads, m_spill_stores;
+  uint64_t m_taken_branches, m_calls;
+  std::vector<uint64_t> m_inst_counts, m_inst_cycles;
+  // _sysy_starttime to _sysy_stoptime, (start line, stop line, cycles)
+  int m_timer_line;
+  uint64_t m_timer_start;
+  std::vector<std::tuple<int, int, uint64_t>> m_timers;
+
+  void load(std::istream& is);
+  void parseInst(const std::string& mnemonic, const std::string& operands,
+                 bool is_spill);
+  void resolve();
+  void setDependencies(SimInst& inst);
+
+  int dataLabel(const std::string& label);
+  bool condPassed(CondType cond);
+  uint32_t operand2(const SimInst& inst);
+  uint32_t address(const SimInst& inst);
+  uint32_t addSub(uint32_t a, uint32_t b, bool carry, bool set_flag);
+  void setNZ(uint32_t val);
+
+  uint32_t read(uint32_t addr);
+  void write(uint32_t addr, uint32_t val);
+  void callSylib(const std::string& name);
+  void systemCall();
+
+public:
+  explicit ARMSimulator(std::istream& is);
+
+  // runs main, returns its exit code
+  int run();
+
+  // counts, cycles and the top hottest blocks by cycles
+  void report(std::ostream& os, int top);
+};
+
+#endif  // BDDD_ARM_SIMULATOR_H
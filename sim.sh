@@ -0,0 +1,21 @@
+#!/bin/sh
+
+# the programs of testSource/spill spill at -O2, bddd-sim has to see it
+for filename in $(ls ./testSource/spill/*.sy); do
+  ./build/bddd -S -o ${filename%.sy}.s $filename -O2
+  ret=$?
+  if [ $ret -ne 0 ]; then
+    echo "GG in $filename"
+    exit 0
+  fi
+  input=${filename%.sy}.in
+  [ -f $input ] || input=/dev/null
+  ./build/bddd-sim ${filename%.sy}.s < $input 2>&1 >/dev/null \
+    | grep -q "(0 spill)"
+  if [ $? -eq 0 ]; then
+    echo "no spill counted in $filename"
+    exit 0
+  fi
+done
+echo "NICE"
+exit 0
@@ -6,6 +6,8 @@ void ASM_Builder::init() {
   m_value_map.clear();
   m_block_map.clear();
   m_load_map.clear();
+  m_div_map.clear();
+  m_global_map.clear();
 }
 
 void ASM_Builder::setIrModule(std::shared_ptr<Module> ir_module) {
@@ -23,28 +25,45 @@ void ASM_Builder::setCurFunction(std::shared_ptr<ASM_Function> func) {
   m_cur_func = func;
 }
 
+std::vector<std::shared_ptr<Operand>> ASM_Builder::getParamRegs(
+    const std::vector<std::shared_ptr<Value>>& params) {
+  std::vector<std::shared_ptr<Operand>> regs;
+  int r = 0, s = 0;
+  for (auto& value : params) {
+    if (value->m_type.IsBasicFloat())
+      regs.push_back(s < 16 ? Operand::getSReg((SReg)s++) : nullptr);
+    else
+      regs.push_back(r < 4 ? Operand::getRReg((RReg)r++) : nullptr);
+  }
+  return regs;
+}
+
 void ASM_Builder::setParams() {
-  int i = 0;
-  int n = m_cur_func->m_ir_func->m_args.size();
+  auto& args = m_cur_func->m_ir_func->m_args;
+  int n = args.size();
   m_cur_func->m_params_size = n;
+  auto regs = getParamRegs(
+      std::vector<std::shared_ptr<Value>>(args.begin(), args.end()));
 
-  // set params in r0 ~ r3
-  while (i < 4 && i < n) {
-    auto value = m_cur_func->m_ir_func->m_args[i];
+  // set params in r0 ~ r3 and s0 ~ s15
+  for (int i = 0; i < n; i++) {
+    if (!regs[i]) continue;
+    auto value = args[i];
     bool is_float = value->m_type.IsBasicFloat();
     auto ret = std::make_shared<Operand>(OperandType::VREG, is_float);
-    auto mov = std::make_shared<MOVInst>(ret, Operand::getRReg((RReg)i));
+    auto mov = std::make_shared<MOVInst>(ret, regs[i]);
     mov->addDef(Operand::getRReg(RReg::R12));
     m_cur_func->m_params_set_list.push_back(mov);
     m_value_map.insert(std::make_pair(value, ret));
-    i++;
   }
 
   // set params in stack
-  while (i < n) {
-    auto value = m_cur_func->m_ir_func->m_args[i];
+  int stack_n = 0;
+  for (int i = 0; i < n; i++) {
+    if (regs[i]) continue;
+    auto value = args[i];
     bool is_float = value->m_type.IsBasicFloat();
-    int fp_offs = (i - 4) * 4;
+    int fp_offs = stack_n++ * 4;
     auto ret = std::make_shared<Operand>(OperandType::VREG, is_float);
     auto ldr = std::make_shared<LDRInst>(ret, Operand::getRReg(RReg::SP),
                                          std::make_shared<Operand>(fp_offs));
@@ -52,7 +71,6 @@ void ASM_Builder::setParams() {
     m_cur_func->m_params_set_list.push_back(ldr);
     m_cur_func->m_stack_params_offs[ret] = fp_offs;
     m_value_map.insert(std::make_pair(value, ret));
-    i++;
   }
 }
 
@@ -60,6 +78,7 @@ void ASM_Builder::appendBlock(std::shared_ptr<ASM_BasicBlock> block) {
   m_cur_func->m_blocks.push_back(block);
   setCurBlock(block);
   m_load_map.clear();
+  m_div_map.clear();
 }
 
 void ASM_Builder::setCurBlock(std::shared_ptr<ASM_BasicBlock> block) {
@@ -124,6 +143,7 @@ std::shared_ptr<ASM_BasicBlock> ASM_Builder::getBlock(
                  : nullptr;
   if (!ret) {
     ret = std::make_shared<ASM_BasicBlock>(ir_block->m_loop_depth);
+    ret->m_frequency = ir_block->m_frequency;
     m_block_map.insert(std::make_pair(ir_block, ret));
   }
   return ret;
@@ -213,8 +233,9 @@ std::shared_ptr<BInst> ASM_Builder::appendB(
 
 // appendCALL
 std::shared_ptr<CALLInst> ASM_Builder::appendCALL(VarType type,
-                                                  std::string label, int n) {
-  auto call = std::make_shared<CALLInst>(type, label, n);
+                                                  std::string label, int n,
+                                                  int f_n) {
+  auto call = std::make_shared<CALLInst>(type, label, n, f_n);
   m_cur_block->insert(call);
   return call;
 }
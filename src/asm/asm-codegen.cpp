@@ -1,8 +1,7 @@
 #include "asm/asm-builder.h"
+#include "asm/asm-schedule.h"
 #include "ir/ir.h"
 
-#define DIV_CONST
-
 std::shared_ptr<Operand> ASM_Builder::GenerateConstant(
     std::shared_ptr<Constant> value, bool genimm, bool checkimm,
     std::shared_ptr<ASM_BasicBlock> phi_block) {
@@ -101,30 +100,124 @@ std::shared_ptr<Operand> GenerateMul(std::shared_ptr<BinaryInstruction> inst,
   return ret;
 }
 
+// -1 if imm is not pow of 2
+int log2Int(int imm) {
+  if (imm <= 0 || (imm & (imm - 1))) return -1;
+  int i = 0;
+  while ((1 << i) != imm) i++;
+  return i;
+}
+
+int movCost(int imm) {
+  if (Operand::immCheck(imm) || Operand::immCheck(~imm)) return MOV_LATENCY;
+  return (imm & 0xffff0000) ? 2 * MOV_LATENCY : MOV_LATENCY;
+}
+
+/*
+  magic number for signed division by constant (Hacker's Delight, 10-1)
+  requires 2 <= |d| <= 2^31 - 1, d is not pow of 2
+  n / d = (hi32(m * n) [+n if d > 0 && m < 0] [-n if d < 0 && m > 0]) >> s
+          + 1 if the result is negative
+*/
+void getDivMagic(int d, int& m, int& s) {
+  const u_int32_t two31 = 0x80000000;
+  u_int32_t ad = d < 0 ? -(u_int32_t)d : d;
+  u_int32_t t = two31 + ((u_int32_t)d >> 31);
+  u_int32_t anc = t - 1 - t % ad;  // absolute value of nc
+  int p = 31;
+  u_int32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+  u_int32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+  u_int32_t delta;
+  do {
+    p++;
+    q1 <<= 1;
+    r1 <<= 1;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 <<= 1;
+    r2 <<= 1;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  m = (int)(q2 + 1);
+  if (d < 0) m = -m;
+  s = p - 32;
+}
+
+// estimated latency of divConst(), plus materializing the devisor for MLS
+int divConstCost(int devisor, bool need_devisor) {
+  int m, s;
+  getDivMagic(devisor, m, s);
+  int cost = movCost(m) + SMMUL_LATENCY + ALU_SHIFT_LATENCY;
+  if (devisor < 0 && m > 0) cost += ALU_LATENCY;
+  if (s) cost += ALU_LATENCY;
+  if (need_devisor) cost += movCost(devisor);
+  return cost;
+}
+
+int sdivCost(int devisor) { return movCost(devisor) + SDIV_LATENCY; }
+
+bool isDivConstProfitable(int devisor, bool need_devisor) {
+  if (devisor == 0 || devisor == INT32_MIN) return false;
+  return divConstCost(devisor, need_devisor) < sdivCost(devisor);
+}
+
+// ret = operand1 / devisor, devisor is neither 0, +-1, INT_MIN nor pow of 2
 void divConst(std::shared_ptr<Operand> ret, std::shared_ptr<Operand> operand1,
               int devisor, std::shared_ptr<ASM_Builder> builder) {
-  u_int32_t d = devisor;
-  u_int64_t n = (1 << 31) - ((1 << 31) % d) - 1;
-  u_int64_t p = 32;
-  while (((u_int64_t)1 << p) <= n * (d - ((u_int64_t)1 << p) % d)) {
-    p++;
-  }
-  u_int64_t m = (((u_int64_t)1 << p) + (u_int64_t)d - ((u_int64_t)1 << p) % d)
-                / (u_int64_t)d;
+  int m, s;
+  getDivMagic(devisor, m, s);
   auto magic_num = std::make_shared<Operand>(OperandType::VREG);
-  builder->appendMOV(magic_num, (int)m);
+  builder->appendMOV(magic_num, m);
   auto mul_ret = std::make_shared<Operand>(OperandType::VREG);
-  if (m >= 0x80000000)
-    builder->appendMUL(InstOp::SMMLA, mul_ret, magic_num, operand1, operand1);
-  else
-    builder->appendMUL(InstOp::SMMUL, mul_ret, magic_num, operand1);
-  auto temp_reg = std::make_shared<Operand>(OperandType::VREG);
-  builder->appendShift(InstOp::ASR, temp_reg, mul_ret,
-                       std::make_shared<Operand>((int)(p - 32)));
-  auto ret_inst = builder->appendAS(InstOp::ADD, ret, temp_reg, operand1);
+  if (devisor > 0 && m < 0) {
+    // hi32(m * n) + n in one instruction
+    builder->appendMUL(InstOp::SMMLA, mul_ret, operand1, magic_num, operand1);
+  } else {
+    builder->appendMUL(InstOp::SMMUL, mul_ret, operand1, magic_num);
+    if (devisor < 0 && m > 0)
+      builder->appendAS(InstOp::SUB, mul_ret, mul_ret, operand1);
+  }
+  std::shared_ptr<Operand> shifted = mul_ret;
+  if (s) {
+    shifted = std::make_shared<Operand>(OperandType::VREG);
+    builder->appendShift(InstOp::ASR, shifted, mul_ret,
+                         std::make_shared<Operand>(s));
+  }
+  // the sign of mul_ret is kept by ASR, add 1 if it is negative
+  auto ret_inst = builder->appendAS(InstOp::ADD, ret, shifted, mul_ret);
   ret_inst->m_shift = std::make_unique<Shift>(Shift::ShiftType::LSR, 31);
 }
 
+// ret = operand1 / (+-2^k), 1 <= k <= 30
+void divPow2(std::shared_ptr<Operand> ret, std::shared_ptr<Operand> operand1,
+             int k, bool negative, std::shared_ptr<ASM_Builder> builder) {
+  // add 2^k - 1 to negative dividend so that the shift rounds towards zero
+  std::shared_ptr<Operand> sign = operand1;
+  if (k > 1) {
+    sign = std::make_shared<Operand>(OperandType::VREG);
+    builder->appendShift(InstOp::ASR, sign, operand1,
+                         std::make_shared<Operand>(k - 1));
+  }
+  auto biased = std::make_shared<Operand>(OperandType::VREG);
+  auto add = builder->appendAS(InstOp::ADD, biased, operand1, sign);
+  add->m_shift = std::make_unique<Shift>(Shift::ShiftType::LSR, 32 - k);
+  if (!negative) {
+    builder->appendShift(InstOp::ASR, ret, biased,
+                         std::make_shared<Operand>(k));
+    return;
+  }
+  auto quotient = std::make_shared<Operand>(OperandType::VREG);
+  builder->appendShift(InstOp::ASR, quotient, biased,
+                       std::make_shared<Operand>(k));
+  builder->appendAS(InstOp::RSB, ret, quotient, std::make_shared<Operand>(0));
+}
+
 std::shared_ptr<Operand> GenerateDiv(std::shared_ptr<BinaryInstruction> inst,
                                      std::shared_ptr<ASM_Builder> builder) {
   std::shared_ptr<Value> val1 = inst->m_lhs_val_use->getValue();
@@ -134,35 +227,38 @@ std::shared_ptr<Operand> GenerateDiv(std::shared_ptr<BinaryInstruction> inst,
   auto ret = builder->getOperand(inst);
   auto operand1 = builder->getOperand(val1);
 
+  if (is_int) {
+    // the quotient may have been computed by a SREM in this block
+    auto key = std::make_pair(val1, val2);
+    auto it = builder->m_div_map.find(key);
+    if (it != builder->m_div_map.end()) {
+      builder->appendMOV(ret, it->second);
+      return ret;
+    }
+    builder->m_div_map[key] = ret;
+  }
+
   if (val2->m_type.IsConst()) {
     auto const_val = std::dynamic_pointer_cast<Constant>(val2);
     if (const_val->m_int_val == 1 || const_val->m_float_val == 1) {
       builder->appendMOV(ret, operand1);
       return ret;
     } else if (is_int) {
-      // check if the value of devisor is pow of 2
-      int temp = 2;
-      for (int i = 1; i < 32; i++) {
-        if (temp == const_val->m_int_val) {
-          auto ret_temp = std::make_shared<Operand>(OperandType::VREG);
-          builder->appendShift(InstOp::ASR, ret_temp, operand1,
-                               std::make_shared<Operand>(i - 1));
-          auto add
-              = builder->appendAS(InstOp::ADD, ret_temp, operand1, ret_temp);
-          add->m_shift = std::make_unique<Shift>(Shift::ShiftType::LSR, 32 - i);
-          builder->appendShift(InstOp::ASR, ret, ret_temp,
-                               std::make_shared<Operand>(i));
-          return ret;
-        }
-        temp <<= 1;
+      int devisor = const_val->m_int_val;
+      if (devisor == -1) {
+        builder->appendAS(InstOp::RSB, ret, operand1,
+                          std::make_shared<Operand>(0));
+        return ret;
+      }
+      int k = devisor == INT32_MIN ? -1 : log2Int(std::abs(devisor));
+      if (k > 0) {
+        divPow2(ret, operand1, k, devisor < 0, builder);
+        return ret;
+      }
+      if (isDivConstProfitable(devisor, false)) {
+        divConst(ret, operand1, devisor, builder);
+        return ret;
       }
-
-      // div const
-      // seems to be a negative optimization?
-#ifdef DIV_CONST
-      divConst(ret, operand1, const_val->m_int_val, builder);
-      return ret;
-#endif
     }
   }
 
@@ -179,48 +275,55 @@ std::shared_ptr<Operand> GenerateMod(std::shared_ptr<BinaryInstruction> inst,
   std::shared_ptr<Value> val2 = inst->m_rhs_val_use->getValue();
   auto ret = builder->getOperand(inst);
   auto devidend = builder->getOperand(val1);
+  auto key = std::make_pair(val1, val2);
   std::shared_ptr<Operand> div_ret;
+  if (builder->m_div_map.find(key) != builder->m_div_map.end()) {
+    div_ret = builder->m_div_map[key];
+  }
 
-  if (val2->m_type.IsConst()) {
+  if (!div_ret && val2->m_type.IsConst()) {
     assert(val2->m_type.IsBasicInt());
     auto const_val = std::dynamic_pointer_cast<Constant>(val2);
-    if (const_val->m_int_val == 1) {
+    int devisor = const_val->m_int_val;
+    if (devisor == 1 || devisor == -1) {
       builder->appendMOV(ret, 0);
       return ret;
     }
-    int temp = 2;
-    for (int i = 1; i < 32; i++) {
-      if (temp == const_val->m_int_val) {
-        int and_val = temp - 1;
-        std::shared_ptr<Operand> and_reg;
-        if (Operand::immCheck(and_val)) {
-          and_reg = std::make_shared<Operand>(and_val);
-        } else {
-          and_reg = std::make_shared<Operand>(OperandType::VREG);
-          builder->appendMOV(and_reg, and_val);
-        }
-        auto and_inst = builder->appendBIT(InstOp::AND, ret, devidend, and_reg);
-        and_inst->m_set_flag = true;
-        auto cmp_inst = builder->appendCT(InstOp::CMP, devidend,
-                                          std::make_shared<Operand>(0));
-        cmp_inst->m_cond = CondType::NE;
-        auto sub_inst = builder->appendAS(InstOp::SUB, ret, ret,
-                                          std::make_shared<Operand>(temp));
-        sub_inst->m_cond = CondType::MI;
-        return ret;
+    // the sign of remainder follows the dividend, so n % -d == n % d
+    int k = devisor == INT32_MIN ? -1 : log2Int(std::abs(devisor));
+    if (k > 0) {
+      int temp = 1 << k;
+      int and_val = temp - 1;
+      std::shared_ptr<Operand> and_reg;
+      if (Operand::immCheck(and_val)) {
+        and_reg = std::make_shared<Operand>(and_val);
+      } else {
+        and_reg = std::make_shared<Operand>(OperandType::VREG);
+        builder->appendMOV(and_reg, and_val);
       }
-      temp <<= 1;
+      auto and_inst = builder->appendBIT(InstOp::AND, ret, devidend, and_reg);
+      and_inst->m_set_flag = true;
+      auto cmp_inst = builder->appendCT(InstOp::CMP, devidend,
+                                        std::make_shared<Operand>(0));
+      cmp_inst->m_cond = CondType::NE;
+      auto sub_inst = builder->appendAS(InstOp::SUB, ret, ret,
+                                        std::make_shared<Operand>(temp));
+      sub_inst->m_cond = CondType::MI;
+      return ret;
+    }
+    if (isDivConstProfitable(devisor, true)) {
+      div_ret = std::make_shared<Operand>(OperandType::VREG);
+      divConst(div_ret, devidend, devisor, builder);
+      builder->m_div_map[key] = div_ret;
     }
-#ifdef DIV_CONST
-    div_ret = std::make_shared<Operand>(OperandType::VREG);
-    divConst(div_ret, devidend, const_val->m_int_val, builder);
-#endif
   }
 
+  // n % d = n - (n / d) * d
   auto devisor = builder->getOperand(val2);
   if (!div_ret) {
     div_ret = std::make_shared<Operand>(OperandType::VREG);
     builder->appendSDIV(div_ret, devidend, devisor);
+    builder->m_div_map[key] = div_ret;
   }
   builder->appendMUL(InstOp::MLS, ret, div_ret, devisor, devidend);
   return ret;
@@ -290,7 +393,9 @@ std::shared_ptr<Operand> GenerateBinary(std::shared_ptr<BinaryInstruction> inst,
     case IROp::F_GE:
     case IROp::F_LT:
     case IROp::F_LE:
-      return GenerateCMP(inst, builder);
+      // branch, zext and select evaluate the comparison right before
+      // themselves, so that nothing in between can change the flags
+      return nullptr;
     case IROp::ZEXT:
     case IROp::FPTOSI:
     case IROp::SITOFP:
@@ -302,7 +407,6 @@ std::shared_ptr<Operand> GenerateBinary(std::shared_ptr<BinaryInstruction> inst,
   return nullptr;
 }
 
-// not support float yet
 std::shared_ptr<Operand> GenerateCall(std::shared_ptr<CallInstruction> inst,
                                       std::shared_ptr<ASM_Builder> builder) {
   if (inst->m_func_name == "llvm.memset.p0i8.i32") {
@@ -319,16 +423,21 @@ std::shared_ptr<Operand> GenerateCall(std::shared_ptr<CallInstruction> inst,
     return nullptr;
   }
 
-  if (inst->m_func_name == "putfloat") {
-    builder->appendMOV(Operand::getSReg(SReg::S0),
-                       builder->getOperand(inst->m_params[0]->getValue()));
-    builder->appendCALL(VarType::VOID, "putfloat", 1);
-    return nullptr;
+  int n = inst->m_params.size();
+  std::vector<std::shared_ptr<Value>> params;
+  for (auto& param : inst->m_params) params.push_back(param->getValue());
+  auto regs = builder->getParamRegs(params);
+  int int_n = 0, float_n = 0;
+  for (auto& value : params) {
+    if (value->m_type.IsBasicFloat())
+      float_n++;
+    else
+      int_n++;
   }
 
-  int n = inst->m_params.size();
   // calculate the stack move size
-  int stack_move_size = std::max(n - 4, 0) * 4;
+  int stack_move_size
+      = (std::max(int_n - 4, 0) + std::max(float_n - 16, 0)) * 4;
   if (stack_move_size) {
     builder->allocSP(stack_move_size);
   }
@@ -337,20 +446,25 @@ std::shared_ptr<Operand> GenerateCall(std::shared_ptr<CallInstruction> inst,
     stack_move_size += 8;
   }
 
-  int i = 0;
-  // save params to r0 ~ r3
-  while (i < 4 && i < n) {
-    std::shared_ptr<Value> value = inst->m_params[i]->getValue();
-    std::shared_ptr<Operand> reg = Operand::getRReg((RReg)i);
-    auto mov = builder->appendMOV(reg, builder->getOperand(value, true, false));
+  // save params to r0 ~ r3 and s0 ~ s15
+  for (int i = 0; i < n; i++) {
+    if (!regs[i]) continue;
+    std::shared_ptr<Value> value = params[i];
+    std::shared_ptr<MOVInst> mov;
+    if (value->m_type.IsBasicFloat())
+      mov = builder->appendMOV(regs[i], builder->getOperand(value));
+    else
+      mov = builder->appendMOV(regs[i],
+                               builder->getOperand(value, true, false));
     mov->m_params_offset = stack_move_size;
-    i++;
   }
 
   // save params to stack
-  while (i < n) {
-    std::shared_ptr<Value> value = inst->m_params[i]->getValue();
-    int sp_offs = (i - 4) * 4;
+  int stack_n = 0;
+  for (int i = 0; i < n; i++) {
+    if (regs[i]) continue;
+    std::shared_ptr<Value> value = params[i];
+    int sp_offs = stack_n++ * 4;
     std::shared_ptr<Operand> offs;
     std::shared_ptr<STRInst> str;
     if (Operand::addrOffsCheck(sp_offs, value->m_type.IsBasicFloat())) {
@@ -383,11 +497,10 @@ std::shared_ptr<Operand> GenerateCall(std::shared_ptr<CallInstruction> inst,
       }
     }
     str->m_params_offset = stack_move_size;
-    i++;
   }
 
   VarType return_type = (VarType)inst->m_type.m_base_type;
-  builder->appendCALL(return_type, inst->m_func_name, n);
+  builder->appendCALL(return_type, inst->m_func_name, int_n, float_n);
 
   // reclaim sp
   if (stack_move_size) {
@@ -428,6 +541,7 @@ std::shared_ptr<Operand> GenerateBranch(std::shared_ptr<BranchInstruction> inst,
     cond = getOppositeCond(cond);
   }
   assert(cond != CondType::NONE);
+  GenerateCMP(inst_cond, builder);
   builder->appendB(true_block, cond);
   builder->m_cur_block->m_branch_pos
       = std::prev(builder->m_cur_block->m_insts.end());
@@ -465,8 +579,14 @@ std::shared_ptr<Operand> getAddr(std::shared_ptr<Value> value,
                                  std::shared_ptr<ASM_Builder> builder) {
   std::shared_ptr<Operand> ret;
   if (auto var = std::dynamic_pointer_cast<GlobalVariable>(value)) {
-    ret = std::make_shared<Operand>(OperandType::VREG);
-    builder->appendLDR(ret, var->m_name);
+    // shared by the whole function, the allocator loads it again near its
+    // uses if it can't keep it in a register
+    auto& ldr = builder->m_global_map[var->m_name];
+    if (!ldr) {
+      ldr = std::make_shared<LDRInst>(
+          std::make_shared<Operand>(OperandType::VREG), var->m_name);
+    }
+    ret = ldr->m_dest;
   } else {
     ret = builder->getOperand(value);
   }
@@ -602,32 +722,16 @@ std::shared_ptr<Operand> GenerateAlloca(std::shared_ptr<AllocaInstruction> inst,
 
 std::shared_ptr<Operand> GeneratePhi(std::shared_ptr<PhiInstruction> inst,
                                      std::shared_ptr<ASM_Builder> builder) {
-  // we need to store the temp result to make sure all PHI instruction execute
-  // in parallel  (XXX)
-#if 1
-  auto tmp = std::make_shared<Operand>(OperandType::VREG, inst->m_type.IsBasicFloat());
+  // copied in parallel on each incoming edge once the function is done
   auto ret = builder->getOperand(inst);
-  builder->appendMOV(ret, tmp);
   for (auto &[ir_block, value] : inst->m_contents) {
     std::shared_ptr<ASM_BasicBlock> block = builder->getBlock(ir_block);
     assert(block);
     if (!value) continue;
     auto src = builder->getOperand(value->getValue(), true, false, block);
-    block->appendFilledMOV(std::make_shared<MOVInst>(tmp, src));
+    block->appendPhiCopy(builder->m_cur_block, ret, src);
   }
   return ret;
-#else
-  // actually we don't have to store the temp result because of SSA form
-  auto ret = builder->getOperand(inst);
-  for (auto &[ir_block, value] : inst->m_contents) {
-    std::shared_ptr<ASM_BasicBlock> block = builder->getBlock(ir_block);
-    assert(block);
-    if (!value) continue;
-    auto src = builder->getOperand(value->getValue(), true, false);
-    block->appendFilledMOV(std::make_shared<MOVInst>(ret, src));
-  }
-  return ret;
-#endif
 }
 
 std::shared_ptr<Operand> GenerateBitCast(
@@ -666,6 +770,7 @@ std::shared_ptr<Operand> GenerateZExt(std::shared_ptr<ZExtInstruction> inst,
     cond = getOppositeCond(cond);
   }
   assert(cond != CondType::NONE);
+  GenerateCMP(inst_cond, builder);
   auto mov_true = builder->appendMOV(ret, 1);
   auto mov_false = builder->appendMOV(ret, 0);
   mov_true->m_cond = cond;
@@ -673,6 +778,39 @@ std::shared_ptr<Operand> GenerateZExt(std::shared_ptr<ZExtInstruction> inst,
   return ret;
 }
 
+std::shared_ptr<Operand> GenerateSelect(std::shared_ptr<SelectInstruction> inst,
+                                        std::shared_ptr<ASM_Builder> builder) {
+  auto ret = builder->getOperand(inst);
+  ret->m_is_float = inst->m_type.IsBasicFloat();
+  auto true_val = inst->m_true_val->getValue();
+  auto false_val = inst->m_false_val->getValue();
+  auto inst_cond
+      = std::dynamic_pointer_cast<BinaryInstruction>(inst->m_cond->getValue());
+  assert(inst_cond != nullptr);
+  bool is_not = false;
+  while (inst_cond->m_op == IROp::XOR) {
+    is_not = !is_not;
+    inst_cond = std::dynamic_pointer_cast<BinaryInstruction>(
+        inst_cond->m_lhs_val_use->getValue());
+  }
+  CondType cond = GetCondFromIR(inst_cond->m_op);
+  if (is_not) {
+    cond = getOppositeCond(cond);
+  }
+  assert(cond != CondType::NONE);
+
+  // MOV ret, false_val
+  // CMP ...
+  // MOVcc ret, true_val
+  auto true_op = builder->getOperand(true_val, true, false);
+  auto false_op = builder->getOperand(false_val, true, false);
+  builder->appendMOV(ret, false_op);
+  GenerateCMP(inst_cond, builder);
+  auto mov_true = builder->appendMOV(ret, true_op);
+  mov_true->m_cond = cond;
+  return ret;
+}
+
 std::shared_ptr<Operand> GenerateSIToFP(std::shared_ptr<SIToFPInstruction> inst,
                                         std::shared_ptr<ASM_Builder> builder) {
   auto src_val = inst->m_val->getValue();
@@ -734,6 +872,9 @@ void GenerateInstruction(std::shared_ptr<Value> ir_value,
     GenerateBitCast(inst, builder);
   } else if (auto inst = std::dynamic_pointer_cast<ZExtInstruction>(ir_value)) {
     GenerateZExt(inst, builder);
+  } else if (auto inst
+             = std::dynamic_pointer_cast<SelectInstruction>(ir_value)) {
+    GenerateSelect(inst, builder);
   } else if (auto inst
              = std::dynamic_pointer_cast<SIToFPInstruction>(ir_value)) {
     GenerateSIToFP(inst, builder);
@@ -762,9 +903,7 @@ void GenerateFunction(std::shared_ptr<Function> ir_func,
 
   builder->m_cur_func->m_blocks.push_back(builder->m_cur_func->m_rblock);
   // insert MOV instruction(from PHI)
-  for (auto &b : func->m_blocks) {
-    b->fillMOV();
-  }
+  func->lowerPhiCopies();
 
   // insert mov instruction in the entry block for loading params
   auto first_block = func->m_blocks.front();
@@ -775,6 +914,12 @@ void GenerateFunction(std::shared_ptr<Function> ir_func,
     func->m_params_pos_map[inst] = std::prev(iter);
     inst->m_block = first_block;
   }
+
+  // and the addresses of globals
+  for (auto &[name, ldr] : builder->m_global_map) {
+    first_block->m_insts.insert(iter, ldr);
+    ldr->m_block = first_block;
+  }
 }
 
 void GenerateModule(std::shared_ptr<Module> ir_module,
@@ -1,9 +1,23 @@
+#include <algorithm>
+
+#include "asm/asm-layout.h"
 #include "asm/asm.h"
+#include "ir/ir-pass-manager.h"
+
+template <class T> bool isZeroFilled(std::shared_ptr<GlobalVariable> var) {
+  for (auto val : std::dynamic_pointer_cast<T>(var)->m_flatten_vals) {
+    if (val != 0) return false;
+  }
+  return true;
+}
 
 // Module part
 void ASM_Module::exportGlobalVar(std::ofstream& ofs) {
   for (auto& var : m_ir_module->m_global_variable_list) {
-    ofs << "\t.data" << std::endl;
+    // zero-filled ones, like the profile counters, take no space in the file
+    bool is_zero = var->m_is_float ? isZeroFilled<FloatGlobalVariable>(var)
+                                   : isZeroFilled<IntGlobalVariable>(var);
+    ofs << (is_zero ? "\t.bss" : "\t.data") << std::endl;
     ofs << "\t.global " << var->m_name << std::endl;
     ofs << "\t.align 2" << std::endl;
     ofs << "\t.type " << var->m_name << ", \%object" << std::endl;
@@ -59,20 +73,61 @@ void ASM_Module::exportASM(std::ofstream& ofs) {
   for (auto& f : m_funcs) {
     f->exportASM(ofs);
   }
+  if (!m_profile_path.empty()) exportProfileDump(ofs);
 
   // sylib generates additional outputs and we have to link it.
   // throw an arbitrary branch here. It should be unreachable.
   ofs << "\tB getint" << std::endl;
 }
 
+// write the block counters to m_profile_path by system calls, which works the
+// same on a board and under qemu-arm
+void ASM_Module::exportProfileDump(std::ofstream& ofs) {
+  int size = 0;
+  for (auto& var : m_ir_module->m_global_variable_list) {
+    auto counts = std::dynamic_pointer_cast<IntGlobalVariable>(var);
+    if (counts && counts->m_name == PROFILE_COUNTS)
+      size = counts->m_flatten_vals.size() * 4;
+  }
+  ofs << "\t.global " PROFILE_DUMP << std::endl;
+  ofs << "\t.align 2" << std::endl;
+  ofs << "\t.type " PROFILE_DUMP ", \%function" << std::endl;
+  ofs << PROFILE_DUMP ":" << std::endl;
+  ofs << "\tPUSH {R4, R7, LR}" << std::endl;
+  // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+  ofs << "\tMOVW R0, #:lower16:.Lprofile_path" << std::endl;
+  ofs << "\tMOVT R0, #:upper16:.Lprofile_path" << std::endl;
+  ofs << "\tMOVW R1, #577" << std::endl;
+  ofs << "\tMOVW R2, #420" << std::endl;
+  ofs << "\tMOV R7, #5" << std::endl;
+  ofs << "\tSVC #0" << std::endl;
+  ofs << "\tCMP R0, #0" << std::endl;
+  ofs << "\tBLT .Lprofile_done" << std::endl;
+  // write(fd, counts, size)
+  ofs << "\tMOV R4, R0" << std::endl;
+  ofs << "\tMOVW R1, #:lower16:" PROFILE_COUNTS << std::endl;
+  ofs << "\tMOVT R1, #:upper16:" PROFILE_COUNTS << std::endl;
+  ofs << "\tMOVW R2, #" << (size & 0xffff) << std::endl;
+  ofs << "\tMOVT R2, #" << ((unsigned int)size >> 16) << std::endl;
+  ofs << "\tMOV R7, #4" << std::endl;
+  ofs << "\tSVC #0" << std::endl;
+  // close(fd)
+  ofs << "\tMOV R0, R4" << std::endl;
+  ofs << "\tMOV R7, #6" << std::endl;
+  ofs << "\tSVC #0" << std::endl;
+  ofs << ".Lprofile_done:" << std::endl;
+  ofs << "\tPOP {R4, R7, PC}" << std::endl;
+  ofs << ".Lprofile_path:" << std::endl;
+  ofs << "\t.asciz \"" << m_profile_path << "\"" << std::endl;
+  ofs << "\t.align 2" << std::endl;
+}
+
 // Function part
 void ASM_Function::exportASM(std::ofstream& ofs) {
   ofs << "\t.global " << m_name << std::endl;
   ofs << "\t.align 2" << std::endl;
   ofs << "\t.type " << m_name << ", \%function" << std::endl;
   ofs << m_name << ":" << std::endl;
-  m_push->exportASM(ofs);
-  m_f_push->exportASM(ofs);
 
   // allocate stack
   int size = m_local_alloc;
@@ -84,7 +139,10 @@ void ASM_Function::exportASM(std::ofstream& ofs) {
     size += 4;
   }
 
-  if (size) {
+  auto exportPrologue = [&]() {
+    m_push->exportASM(ofs);
+    m_f_push->exportASM(ofs);
+    if (!size) return;
     // this part is taken from tinbaccc directly
     if (Operand::immCheck(size)) {
       ofs << "\tSUB SP, SP, #" << std::to_string(size) << std::endl;
@@ -94,27 +152,82 @@ void ASM_Function::exportASM(std::ofstream& ofs) {
         ofs << "\tMOVT R12, #" << ((unsigned int)size >> 16) << std::endl;
       ofs << "\tSUB SP, SP, R12" << std::endl;
     }
-  }
+  };
+
+  auto exportEpilogue = [&](bool tail) {
+    if (m_frameless) return;
+    if (size) {
+      // this part is taken from tinbaccc directly
+      if (Operand::immCheck(size)) {
+        ofs << "\tADD SP, SP, #" << std::to_string(size) << std::endl;
+      } else {
+        ofs << "\tMOVW R12, #" << (size & 0xffff) << std::endl;
+        if (size & 0xffff0000)
+          ofs << "\tMOVT R12, #" << ((unsigned int)size >> 16) << std::endl;
+        ofs << "\tADD SP, SP, R12" << std::endl;
+      }
+    }
+    m_f_pop->exportASM(ofs);
+    if (!tail) {
+      m_pop->exportASM(ofs);
+      return;
+    }
+    // restore lr instead of returning, the callee returns for us
+    PInst pop(InstOp::POP);
+    pop.m_regs = m_pop->m_regs;
+    pop.m_regs.erase(Operand::getRReg(RReg::PC));
+    pop.m_regs.insert(Operand::getRReg(RReg::LR));
+    pop.exportASM(ofs);
+  };
 
+  if (!m_frameless && !m_frame_block) exportPrologue();
+
+  // loop headers, the targets of branches from blocks after them
+  std::unordered_set<std::shared_ptr<ASM_BasicBlock>> seen, headers;
   for (auto& b : m_blocks) {
-    b->exportASM(ofs);
+    seen.insert(b);
+    for (auto& i : b->m_insts) {
+      auto br = std::dynamic_pointer_cast<BInst>(i);
+      if (!i->m_is_deleted && br && seen.count(br->m_target))
+        headers.insert(br->m_target);
+    }
   }
 
-  if (size) {
-    // this part is taken from tinbaccc directly
-    if (Operand::immCheck(size)) {
-      ofs << "\tADD SP, SP, #" << std::to_string(size) << std::endl;
-    } else {
-      ofs << "\tMOVW R12, #" << (size & 0xffff) << std::endl;
-      if (size & 0xffff0000)
-        ofs << "\tMOVT R12, #" << ((unsigned int)size >> 16) << std::endl;
-      ofs << "\tADD SP, SP, R12" << std::endl;
+  for (auto& b : m_blocks) {
+    if (headers.count(b))
+      ofs << "\t.p2align " << LOOP_ALIGN << ",," << LOOP_ALIGN_MAX_SKIP
+          << std::endl;
+    ofs << b->m_label << ":" << std::endl;
+    if (b == m_fast_rblock) {
+      ofs << "\tBX LR" << std::endl;
+      continue;
+    }
+    if (b == m_frame_block) exportPrologue();
+    for (auto& i : b->m_insts) {
+      if (i->m_is_deleted) continue;
+      auto call = std::dynamic_pointer_cast<CALLInst>(i);
+      if (call && call->m_is_tail) {
+        exportEpilogue(true);
+        ofs << "\tB " << call->m_label << std::endl;
+        continue;
+      }
+      // for the spill counts of bddd-sim
+      if (i->m_is_spill) ofs << "\t@ spill" << std::endl;
+      i->exportASM(ofs);
     }
   }
 
-  m_f_pop->exportASM(ofs);
-  m_pop->exportASM(ofs);
-  ofs << "\t.pool" << std::endl;
+  if (m_frameless)
+    ofs << "\tBX LR" << std::endl;
+  else
+    exportEpilogue(false);
+
+  if (m_fast_rblock
+      && std::find(m_blocks.begin(), m_blocks.end(), m_fast_rblock)
+             == m_blocks.end()) {
+    ofs << m_fast_rblock->m_label << ":" << std::endl;
+    ofs << "\tBX LR" << std::endl;
+  }
   ofs << "\t.size " << m_name << ", .-" << m_name << std::endl;
 }
 
@@ -137,18 +250,22 @@ void ASM_Instruction::exportInstHead(std::ofstream& ofs) {
 }
 
 void LDRInst::exportASM(std::ofstream& ofs) {
-  exportInstHead(ofs);
-  ofs << m_dest->getName() << ", ";
   if (m_type == Type::LABEL) {
-    ofs << "=" << m_label << std::endl;
-  } else {
-    ofs << "[" << m_src->getName() << ", " << m_offs->getName();
-    if (m_shift) {
-      ofs << ", ";
-      m_shift->exportASM(ofs);
-    }
-    ofs << "]" << std::endl;
+    // the address is built by MOVW and MOVT instead of loaded from a pool
+    ofs << "\tMOVW" << getCondName() << " " << m_dest->getName()
+        << ", #:lower16:" << m_label << std::endl;
+    ofs << "\tMOVT" << getCondName() << " " << m_dest->getName()
+        << ", #:upper16:" << m_label << std::endl;
+    return;
+  }
+  exportInstHead(ofs);
+  ofs << m_dest->getName() << ", [" << m_src->getName() << ", "
+      << m_offs->getName();
+  if (m_shift) {
+    ofs << ", ";
+    m_shift->exportASM(ofs);
   }
+  ofs << "]" << std::endl;
 }
 
 void STRInst::exportASM(std::ofstream& ofs) {
@@ -216,6 +333,27 @@ void PInst::exportBody(std::ofstream& ofs,
   ofs << "}" << std::endl;
 }
 
+void LSMInst::exportASM(std::ofstream& ofs) {
+  if (m_op == InstOp::LDRD || m_op == InstOp::STRD) {
+    exportInstHead(ofs);
+    ofs << m_regs[0]->getName() << ", " << m_regs[1]->getName() << ", ["
+        << m_base->getName() << ", #" << m_offs << "]" << std::endl;
+    return;
+  }
+  // the addressing mode goes before the condition
+  ofs << "\t" << getOpName();
+  if (m_offs == 4)
+    ofs << "IB";
+  else if (m_offs < 0)
+    ofs << "DB";
+  ofs << getCondName() << " " << m_base->getName() << ", {";
+  for (int i = 0; i < m_regs.size(); i++) {
+    if (i) ofs << ", ";
+    ofs << m_regs[i]->getName();
+  }
+  ofs << "}" << std::endl;
+}
+
 void BInst::exportASM(std::ofstream& ofs) {
   exportInstHead(ofs);
   ofs << m_target->m_label << std::endl;
@@ -291,12 +429,6 @@ void CTInst::exportASM(std::ofstream& ofs) {
   }
 }
 
-void POOLInst::exportASM(std::ofstream& ofs) {
-  ofs << "\tB .pool_" << std::to_string(m_number) << std::endl;
-  ofs << "\t.pool" << std::endl;
-  ofs << ".pool_" << std::to_string(m_number) << ":" << std::endl;
-}
-
 void VNEGInst::exportASM(std::ofstream& ofs) {
   exportInstHead(ofs);
   ofs << m_dest->getName() << ", " << m_operand->getName() << std::endl;
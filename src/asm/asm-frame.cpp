@@ -0,0 +1,271 @@
+//
+// tail calls and shrink-wrapping after all the other passes
+//
+// a call right before the return, with no arguments on the stack, tears the
+// frame down and branches to the callee, which then returns for the caller.
+// not in a function with allocas, the arguments may point into its frame
+//
+// the frame (saved registers and the stack) is set up at the start of the
+// block dominating every block that needs it, instead of at the entry, if
+// the region it dominates only leaves to the return block. paths that never
+// enter that region return through a block of their own without a frame, and
+// a function that needs no frame at all gets neither prologue nor epilogue
+//
+
+#include "asm/asm-frame.h"
+
+#include <algorithm>
+#include <functional>
+
+typedef std::shared_ptr<ASM_BasicBlock> BlockPtr;
+typedef std::shared_ptr<ASM_Instruction> InstPtr;
+
+// the last instruction of block, nullptr if it is empty
+InstPtr getLastInst(BlockPtr block) {
+  for (auto iter = block->m_insts.rbegin(); iter != block->m_insts.rend();
+       iter++) {
+    if (!(*iter)->m_is_deleted) return *iter;
+  }
+  return nullptr;
+}
+
+// whether func keeps anything in its frame whose address is taken, every
+// alloca is addressed from sp
+bool hasLocalAlloc(std::shared_ptr<ASM_Function> func) {
+  for (auto& bb : func->m_ir_func->m_bb_list) {
+    for (auto& instr : bb->m_instr_list) {
+      if (std::dynamic_pointer_cast<AllocaInstruction>(instr)) return true;
+    }
+  }
+  return false;
+}
+
+void markTailCalls(std::shared_ptr<ASM_Function> func) {
+  auto isEmpty = [](BlockPtr block) { return !getLastInst(block); };
+  if (!isEmpty(func->m_rblock)) return;
+  // an argument may point into the frame, which the callee's would overwrite
+  if (hasLocalAlloc(func)) return;
+  int cnt = 0;
+  for (auto iter = func->m_blocks.begin(); iter != func->m_blocks.end();
+       iter++) {
+    auto block = *iter;
+    if (block == func->m_rblock) continue;
+    // the return is a branch to the return block or falling through to it
+    std::shared_ptr<BInst> ret;
+    InstPtr last = nullptr;
+    for (auto inst = block->m_insts.rbegin(); inst != block->m_insts.rend();
+         inst++) {
+      if ((*inst)->m_is_deleted) continue;
+      auto b = std::dynamic_pointer_cast<BInst>(*inst);
+      if (!ret && !last && b && b->m_target == func->m_rblock
+          && b->m_cond == CondType::NONE) {
+        ret = b;
+        continue;
+      }
+      last = *inst;
+      break;
+    }
+    if (!ret) {
+      auto next = std::next(iter);
+      while (next != func->m_blocks.end() && isEmpty(*next)
+             && *next != func->m_rblock)
+        next++;
+      if (next == func->m_blocks.end() || *next != func->m_rblock) continue;
+    }
+    auto call = std::dynamic_pointer_cast<CALLInst>(last);
+    if (!call || call->m_cond != CondType::NONE || call->m_params > 4
+        || call->m_f_params > 16)
+      continue;
+    call->m_is_tail = true;
+    if (ret) ret->m_is_deleted = true;
+    cnt++;
+  }
+  if (cnt)
+    std::cerr << "[debug] " << func->m_name << ": tail call x" << cnt
+              << std::endl;
+}
+
+void markTailCalls(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) {
+    markTailCalls(func);
+  }
+}
+
+// whether inst needs the saved registers, lr or the stack. colored values
+// are operands of their own, registers are compared by number
+bool needsFrame(std::shared_ptr<ASM_Function> func, InstPtr inst) {
+  if (inst->m_op == InstOp::BL) return true;
+  std::unordered_set<int> regs = {(int)RReg::SP, (int)RReg::LR};
+  std::unordered_set<int> f_regs;
+  for (auto& reg : func->m_push->m_regs) regs.insert((int)reg->m_rreg);
+  for (auto& reg : func->m_f_push->m_regs) f_regs.insert((int)reg->m_sreg);
+  auto touches = [&](const std::unordered_set<std::shared_ptr<Operand>>& ops) {
+    for (auto& op : ops) {
+      if (op->m_op_type != OperandType::REG) continue;
+      if (op->m_is_float ? f_regs.count((int)op->m_sreg)
+                         : regs.count((int)op->m_rreg))
+        return true;
+    }
+    return false;
+  };
+  return touches(inst->m_def) || touches(inst->m_use)
+         || touches(inst->m_f_def) || touches(inst->m_f_use);
+}
+
+void shrinkWrap(std::shared_ptr<ASM_Function> func) {
+  // successors by the branches, which are the only ones up to date now
+  std::vector<BlockPtr> blocks(func->m_blocks.begin(), func->m_blocks.end());
+  std::unordered_map<BlockPtr, int> index;
+  auto isTailCall = [](InstPtr inst) {
+    auto call = std::dynamic_pointer_cast<CALLInst>(inst);
+    return call && call->m_is_tail;
+  };
+  for (int i = 0; i < (int)blocks.size(); i++) index[blocks[i]] = i;
+  int n = blocks.size();
+  std::vector<std::vector<int>> succs(n), preds(n);
+  std::vector<bool> falls_through(n, false);
+  for (int i = 0; i < n; i++) {
+    if (blocks[i] == func->m_rblock) continue;
+    for (auto& inst : blocks[i]->m_insts) {
+      auto b = std::dynamic_pointer_cast<BInst>(inst);
+      if (!inst->m_is_deleted && b) succs[i].push_back(index[b->m_target]);
+    }
+    auto last_inst = getLastInst(blocks[i]);
+    auto last = std::dynamic_pointer_cast<BInst>(last_inst);
+    if ((!last || last->m_cond != CondType::NONE) && !isTailCall(last_inst)
+        && i + 1 < n) {
+      succs[i].push_back(i + 1);
+      falls_through[i] = true;
+    }
+    for (int s : succs[i]) preds[s].push_back(i);
+  }
+
+  // a tail call needs the frame only to tear it down
+  std::vector<bool> need(n, false);
+  bool any_need = false;
+  for (int i = 0; i < n; i++) {
+    for (auto& inst : blocks[i]->m_insts) {
+      if (inst->m_is_deleted) continue;
+      if (isTailCall(inst)) {
+        need[i] = true;
+      } else if (needsFrame(func, inst)) {
+        need[i] = true;
+        any_need = true;
+      }
+    }
+  }
+  if (!any_need) {
+    func->m_frameless = true;
+    std::cerr << "[debug] " << func->m_name << ": no frame" << std::endl;
+    return;
+  }
+  if (need[0]) return;
+
+  // the prologue can't take r12 for a large stack in the middle of the code
+  int size = func->m_local_alloc;
+  if (size & 7) {
+    size &= ~(unsigned int)7;
+    size += 8;
+  }
+  if (func->getPushSize() % 2) size += 4;
+  if (!Operand::immCheck(size)) return;
+
+  // dominators by "A Simple, Fast Dominance Algorithm"
+  std::vector<int> rpo, order(n, -1);
+  std::vector<bool> visited(n, false);
+  std::function<void(int)> dfs = [&](int b) {
+    visited[b] = true;
+    for (int s : succs[b]) {
+      if (!visited[s]) dfs(s);
+    }
+    rpo.push_back(b);
+  };
+  dfs(0);
+  std::reverse(rpo.begin(), rpo.end());
+  for (int i = 0; i < (int)rpo.size(); i++) order[rpo[i]] = i;
+  std::vector<int> idom(n, -1);
+  idom[0] = 0;
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (order[a] > order[b]) a = idom[a];
+      while (order[b] > order[a]) b = idom[b];
+    }
+    return a;
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int b : rpo) {
+      if (b == 0) continue;
+      int new_idom = -1;
+      for (int p : preds[b]) {
+        if (order[p] == -1 || idom[p] == -1) continue;
+        new_idom = new_idom == -1 ? p : intersect(p, new_idom);
+      }
+      if (new_idom != idom[b]) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // the nearest dominator of the blocks needing the frame outside loops
+  int save = -1;
+  for (int i = 0; i < n; i++) {
+    if (!need[i] || order[i] == -1) continue;
+    save = save == -1 ? i : intersect(save, i);
+  }
+  while (save != 0 && blocks[save]->m_loop_depth > 0) save = idom[save];
+  if (save == 0) return;
+
+  int rblock = index[func->m_rblock];
+  auto dominates = [&](int a, int b) {
+    for (; b != 0; b = idom[b]) {
+      if (b == a) return true;
+    }
+    return a == 0;
+  };
+  std::vector<bool> region(n, false);
+  for (int i = 0; i < n; i++) region[i] = order[i] != -1 && dominates(save, i);
+  if (region[rblock]) return;
+  for (int i = 0; i < n; i++) {
+    if (!region[i]) continue;
+    for (int s : succs[i]) {
+      if (!region[s] && s != rblock) return;
+    }
+  }
+  for (int p : preds[save]) {
+    if (region[p]) return;
+  }
+
+  // returns from outside the region go to a block returning without a frame
+  auto fast_rblock = std::make_shared<ASM_BasicBlock>();
+  for (int i = 0; i < n; i++) {
+    if (region[i] || i == rblock) continue;
+    for (auto& inst : blocks[i]->m_insts) {
+      auto b = std::dynamic_pointer_cast<BInst>(inst);
+      if (!inst->m_is_deleted && b && b->m_target == func->m_rblock)
+        b->m_target = fast_rblock;
+    }
+  }
+  // laid out right before the return block, the block before it falls
+  // through to it instead of branching
+  int last = rblock - 1;
+  if (last >= 0 && !region[last]) {
+    auto b = std::dynamic_pointer_cast<BInst>(getLastInst(blocks[last]));
+    if (b && b->m_target == fast_rblock && b->m_cond == CondType::NONE)
+      b->m_is_deleted = true;
+    if (falls_through[last] || (b && b->m_is_deleted))
+      func->m_blocks.insert(std::next(func->m_blocks.begin(), rblock),
+                            fast_rblock);
+  }
+  func->m_frame_block = blocks[save];
+  func->m_fast_rblock = fast_rblock;
+  std::cerr << "[debug] " << func->m_name << ": frame in "
+            << blocks[save]->m_label << std::endl;
+}
+
+void shrinkWrap(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) {
+    shrinkWrap(func);
+  }
+}
@@ -0,0 +1,199 @@
+//
+// block placement by "Profile Guided Code Positioning" (Pettis and Hansen)
+//
+// every block starts as a chain of its own. the edges are visited from the
+// most frequently taken one, and an edge from the tail of a chain to the
+// head of another joins the two, so that it falls through. the chains are
+// then laid out from the hottest head, with the entry first and the return
+// block last, which leaves the cold paths at the end of the function
+//
+// the frequencies are the ones of the profile if there is one. otherwise
+// they are propagated from the entry along the edges that aren't back edges,
+// with the probabilities in asm-layout.h, and a loop header runs
+// LAYOUT_LOOP_WEIGHT times as often as the blocks entering it
+//
+
+#include "asm/asm-layout.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+
+typedef std::shared_ptr<ASM_BasicBlock> BlockPtr;
+
+struct LayoutEdge {
+  int from;
+  int to;
+  double weight;
+};
+
+// whether block goes on to the block after it
+static bool fallsThrough(BlockPtr block) {
+  for (auto iter = block->m_insts.rbegin(); iter != block->m_insts.rend();
+       iter++) {
+    if ((*iter)->m_is_deleted) continue;
+    auto b = std::dynamic_pointer_cast<BInst>(*iter);
+    return !b || b->m_cond != CondType::NONE;
+  }
+  return true;
+}
+
+void layoutBlocks(std::shared_ptr<ASM_Function> func) {
+  std::vector<BlockPtr> blocks(func->m_blocks.begin(), func->m_blocks.end());
+  int n = blocks.size();
+  if (n <= 3 || blocks.back() != func->m_rblock) return;
+  std::unordered_map<BlockPtr, int> index;
+  for (int i = 0; i < n; i++) index[blocks[i]] = i;
+
+  // a block falling through jumps instead, eliminateRedundantJump removes
+  // the jumps to the block right after them again
+  for (int i = 0; i + 1 < n; i++) {
+    if (!fallsThrough(blocks[i])) continue;
+    blocks[i]->insert(std::make_shared<BInst>(blocks[i + 1]));
+    if (blocks[i]->m_branch_pos == blocks[i]->m_insts.end())
+      blocks[i]->m_branch_pos = std::prev(blocks[i]->m_insts.end());
+  }
+
+  // successors by the branches, each of them once
+  std::vector<std::vector<int>> succs(n), preds(n);
+  for (int i = 0; i + 1 < n; i++) {
+    for (auto& inst : blocks[i]->m_insts) {
+      auto b = std::dynamic_pointer_cast<BInst>(inst);
+      if (inst->m_is_deleted || !b || !index.count(b->m_target)) continue;
+      int s = index[b->m_target];
+      if (std::find(succs[i].begin(), succs[i].end(), s) != succs[i].end())
+        continue;
+      succs[i].push_back(s);
+      preds[s].push_back(i);
+    }
+  }
+
+  std::vector<double> freq(n, 0);
+  bool profiled = blocks.front()->m_frequency >= 0;
+  if (profiled) {
+    for (int i = 0; i < n; i++) freq[i] = blocks[i]->m_frequency;
+    // blocks made after the profile was read run at most as often as the
+    // blocks around them
+    for (int i = 0; i < n; i++) {
+      if (freq[i] >= 0) continue;
+      freq[i] = 0;
+      if (!preds[i].empty() && !succs[i].empty())
+        freq[i] = std::max(0.0, std::min(freq[preds[i][0]], freq[succs[i][0]]));
+    }
+  }
+
+  auto isReturn = [&](int i) {
+    return blocks[i] == func->m_rblock
+           || (succs[i].size() == 1 && blocks[succs[i][0]] == func->m_rblock);
+  };
+  // probability of i branching to its successor s
+  auto getProb = [&](int i, int s) -> double {
+    if (profiled) {
+      double sum = 0;
+      for (int t : succs[i]) sum += freq[t];
+      return sum > 0 ? freq[s] / sum : 1.0 / succs[i].size();
+    }
+    if (succs[i].size() != 2) return 1.0 / succs[i].size();
+    int other = succs[i][0] == s ? succs[i][1] : succs[i][0];
+    int depth = blocks[s]->m_loop_depth;
+    int other_depth = blocks[other]->m_loop_depth;
+    if (depth != other_depth)
+      return depth > other_depth ? LAYOUT_LOOP_PROB : 1 - LAYOUT_LOOP_PROB;
+    if (isReturn(s) != isReturn(other))
+      return isReturn(s) ? LAYOUT_RETURN_PROB : 1 - LAYOUT_RETURN_PROB;
+    return 0.5;
+  };
+
+  // reverse postorder, and the back edges to the loop headers
+  std::vector<int> rpo;
+  std::vector<int> state(n, 0);  // 1 on the stack, 2 done
+  std::set<std::pair<int, int>> back_edges;
+  std::vector<bool> is_header(n, false);
+  std::function<void(int)> visit = [&](int i) {
+    state[i] = 1;
+    for (int s : succs[i]) {
+      if (state[s] == 1) {
+        back_edges.insert({i, s});
+        is_header[s] = true;
+      } else if (!state[s]) {
+        visit(s);
+      }
+    }
+    state[i] = 2;
+    rpo.push_back(i);
+  };
+  visit(0);
+  std::reverse(rpo.begin(), rpo.end());
+
+  if (!profiled) {
+    freq[0] = 1;
+    for (int i : rpo) {
+      if (is_header[i]) freq[i] *= LAYOUT_LOOP_WEIGHT;
+      for (int s : succs[i])
+        if (!back_edges.count({i, s})) freq[s] += freq[i] * getProb(i, s);
+    }
+  }
+
+  // a back edge doesn't fall through, so that the loops keep their headers
+  // first, as pipelineLoops expects them
+  std::vector<LayoutEdge> edges;
+  for (int i = 0; i < n; i++) {
+    for (int s : succs[i]) {
+      if (s != 0 && !back_edges.count({i, s}))
+        edges.push_back({i, s, freq[i] * getProb(i, s)});
+    }
+  }
+  std::stable_sort(edges.begin(), edges.end(),
+                   [](const LayoutEdge& a, const LayoutEdge& b) {
+                     return a.weight > b.weight;
+                   });
+
+  std::vector<int> chain_of(n);
+  std::vector<std::vector<int>> chains(n);
+  for (int i = 0; i < n; i++) {
+    chain_of[i] = i;
+    chains[i] = {i};
+  }
+  for (auto& edge : edges) {
+    int a = chain_of[edge.from], b = chain_of[edge.to];
+    if (a == b || chains[a].back() != edge.from
+        || chains[b].front() != edge.to)
+      continue;
+    // the other chains have to fit between the entry and the return block
+    if (a == chain_of[0] && b == chain_of[n - 1]) continue;
+    for (int i : chains[b]) chain_of[i] = a;
+    chains[a].insert(chains[a].end(), chains[b].begin(), chains[b].end());
+    chains[b].clear();
+  }
+
+  // the entry can't be the target of a join, the return block has no
+  // successors, so they stay the head and the tail of their chains
+  int first = chain_of[0], last = chain_of[n - 1];
+  std::vector<int> middle;
+  for (int c = 0; c < n; c++) {
+    if (!chains[c].empty() && c != first && c != last) middle.push_back(c);
+  }
+  std::stable_sort(middle.begin(), middle.end(), [&](int a, int b) {
+    return freq[chains[a].front()] > freq[chains[b].front()];
+  });
+  std::vector<int> order = chains[first];
+  for (int c : middle)
+    order.insert(order.end(), chains[c].begin(), chains[c].end());
+  order.insert(order.end(), chains[last].begin(), chains[last].end());
+
+  int cnt = 0;
+  func->m_blocks.clear();
+  for (int i = 0; i < n; i++) {
+    if (order[i] != i) cnt++;
+    func->m_blocks.push_back(blocks[order[i]]);
+  }
+  if (cnt)
+    std::cerr << "[debug] " << func->m_name << ": layout moved x" << cnt
+              << std::endl;
+}
+
+void layoutBlocks(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) {
+    layoutBlocks(func);
+  }
+}
@@ -15,6 +15,8 @@ void ASM_Function::LivenessAnalysis(RegType reg_type) {
         defs = i->m_f_def;
         uses = i->m_f_use;
       }
+      // a conditional def keeps the old value when not executed
+      if (i->m_cond != CondType::NONE) uses.insert(defs.begin(), defs.end());
       for (auto& use : uses) {
         if (b->m_def.find(use) == b->m_def.end()) {
           b->m_use.insert(use);
@@ -166,6 +168,18 @@ void PInst::replaceUse(std::shared_ptr<Operand> newOp,
   return;
 }
 
+void LSMInst::replaceDef(std::shared_ptr<Operand> newOp,
+                         std::shared_ptr<Operand> oldOp) {
+  assert(false);
+  return;
+}
+
+void LSMInst::replaceUse(std::shared_ptr<Operand> newOp,
+                         std::shared_ptr<Operand> oldOp) {
+  assert(false);
+  return;
+}
+
 void BInst::replaceDef(std::shared_ptr<Operand> newOp,
                        std::shared_ptr<Operand> oldOp) {
   assert(false);
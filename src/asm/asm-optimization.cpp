@@ -1,5 +1,11 @@
 #include "asm/asm-optimization.h"
 
+#include "asm/asm-layout.h"
+#include "asm/asm-peephole.h"
+#include "asm/asm-pipeline.h"
+#include "asm/asm-schedule.h"
+#include "asm/asm-split.h"
+
 void eliminateRedundantMOV(std::shared_ptr<ASM_Module> module) {
   for (auto& func : module->m_funcs) {
     for (auto& block : func->m_blocks) {
@@ -135,11 +141,6 @@ void combineInstruction(std::shared_ptr<ASM_Module> module) {
           inst_map;
       for (auto& inst : block->m_insts) {
         if (inst->m_is_deleted) continue;
-        if (inst->m_op == InstOp::MUL) {
-          auto i = std::dynamic_pointer_cast<MULInst>(inst);
-          if (i->m_dest->m_op_type == OperandType::VREG)
-            inst_map[i->m_dest] = inst;
-        }
         if (auto i = std::dynamic_pointer_cast<ShiftInst>(inst))
           if (i->m_dest->m_op_type == OperandType::VREG)
             inst_map[i->m_dest] = inst;
@@ -152,11 +153,6 @@ void combineInstruction(std::shared_ptr<ASM_Module> module) {
             else if (inst_map.find(i->m_operand2) != inst_map.end())
               def_inst = inst_map[i->m_operand2];
             std::shared_ptr<ASM_Instruction> ret_inst;
-            if (auto mul = std::dynamic_pointer_cast<MULInst>(def_inst)) {
-              inst = combineMULToADD(mul, i);
-              inst->m_block = block;
-              cnt++;
-            }
             if (auto shift = std::dynamic_pointer_cast<ShiftInst>(def_inst)) {
               inst = combineShiftToADD(shift, i);
               inst->m_block = block;
@@ -167,18 +163,7 @@ void combineInstruction(std::shared_ptr<ASM_Module> module) {
       }
     }
   }
-  std::cerr << "[debug] combine shift/mul inst to add x" << cnt << std::endl;
-}
-
-std::shared_ptr<ASM_Instruction> combineMULToADD(std::shared_ptr<MULInst> mul,
-                                                 std::shared_ptr<ASInst> as) {
-  auto ret = as->m_dest;
-  auto op1 = as->m_operand1;
-  if (op1 == mul->m_dest) {
-    op1 = as->m_operand2;
-  }
-  return std::make_shared<MULInst>(InstOp::MLA, ret, mul->m_operand1,
-                                   mul->m_operand2, op1);
+  std::cerr << "[debug] combine shift inst to add x" << cnt << std::endl;
 }
 
 std::shared_ptr<ASM_Instruction> combineShiftToADD(
@@ -195,6 +180,107 @@ std::shared_ptr<ASM_Instruction> combineShiftToADD(
   return ret_inst;
 }
 
+// fold the address computation into the memory access:
+//   ADD addr, base, idx, LSL #2; LDR r, [addr, #0] => LDR r, [base, idx, LSL #2]
+//   ADD addr, base, #imm;        LDR r, [addr, #0] => LDR r, [base, #imm]
+// the ADD is left for eliminateDeadInstruction
+void combineAddressing(std::shared_ptr<ASM_Module> module) {
+  int cnt = 0;
+  for (auto& func : module->m_funcs) {
+    for (auto& block : func->m_blocks) {
+      // address -> ADD computing it, valid while its operands are not redefined
+      std::unordered_map<std::shared_ptr<Operand>, std::shared_ptr<ASInst>>
+          add_map;
+      for (auto& inst : block->m_insts) {
+        if (inst->m_is_deleted) continue;
+        if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+          if (ldr->m_type == LDRInst::Type::REG
+              && add_map.find(ldr->m_src) != add_map.end()) {
+            if (auto new_inst = combineADDToAddr(add_map[ldr->m_src], ldr)) {
+              inst = new_inst;
+              inst->m_block = block;
+              cnt++;
+            }
+          }
+        } else if (auto str = std::dynamic_pointer_cast<STRInst>(inst)) {
+          if (add_map.find(str->m_dest) != add_map.end()) {
+            if (auto new_inst = combineADDToAddr(add_map[str->m_dest], str)) {
+              inst = new_inst;
+              inst->m_block = block;
+              cnt++;
+            }
+          }
+        }
+
+        for (auto& def : inst->m_def) {
+          for (auto iter = add_map.begin(); iter != add_map.end();) {
+            auto add = iter->second;
+            if (iter->first == def || add->m_operand1 == def
+                || add->m_operand2 == def)
+              iter = add_map.erase(iter);
+            else
+              iter++;
+          }
+        }
+        if (inst->m_op == InstOp::ADD && inst->m_cond == CondType::NONE) {
+          auto add = std::dynamic_pointer_cast<ASInst>(inst);
+          // physical registers other than SP may be clobbered by calls
+          if (add->m_dest->m_op_type == OperandType::VREG
+              && (add->m_operand1->m_op_type == OperandType::VREG
+                  || add->m_operand1 == Operand::getRReg(RReg::SP))
+              && add->m_operand2->m_op_type != OperandType::REG)
+            add_map[add->m_dest] = add;
+        }
+      }
+    }
+  }
+  std::cerr << "[debug] combine add inst to addressing mode x" << cnt
+            << std::endl;
+}
+
+std::shared_ptr<ASM_Instruction> combineADDToAddr(
+    std::shared_ptr<ASInst> add, std::shared_ptr<ASM_Instruction> mem) {
+  auto ldr = std::dynamic_pointer_cast<LDRInst>(mem);
+  auto str = std::dynamic_pointer_cast<STRInst>(mem);
+  auto offs = ldr ? ldr->m_offs : str->m_offs;
+  bool is_float = ldr ? ldr->m_dest->m_is_float : str->m_src->m_is_float;
+  if (offs->m_op_type != OperandType::IMM || offs->m_int_val != 0
+      || (ldr ? ldr->m_shift : str->m_shift))
+    return nullptr;
+
+  std::shared_ptr<Operand> new_offs;
+  if (add->m_operand2->m_op_type == OperandType::IMM) {
+    if (!Operand::addrOffsCheck(add->m_operand2->m_int_val, is_float))
+      return nullptr;
+    new_offs = std::make_shared<Operand>(add->m_operand2->m_int_val);
+  } else {
+    // VLDR/VSTR have no register offset
+    if (is_float) return nullptr;
+    if (add->m_shift && add->m_shift->s_type == Shift::ShiftType::RRX)
+      return nullptr;
+    new_offs = add->m_operand2;
+  }
+
+  std::shared_ptr<ASM_Instruction> ret;
+  if (ldr) {
+    auto new_ldr
+        = std::make_shared<LDRInst>(ldr->m_dest, add->m_operand1, new_offs);
+    if (add->m_shift)
+      new_ldr->m_shift = std::make_unique<Shift>(add->m_shift->s_type,
+                                                 add->m_shift->s_val);
+    ret = new_ldr;
+  } else {
+    auto new_str
+        = std::make_shared<STRInst>(str->m_src, add->m_operand1, new_offs);
+    if (add->m_shift)
+      new_str->m_shift = std::make_unique<Shift>(add->m_shift->s_type,
+                                                 add->m_shift->s_val);
+    ret = new_str;
+  }
+  ret->m_params_offset = mem->m_params_offset;
+  return ret;
+}
+
 void eliminateDeadInstruction(std::shared_ptr<ASM_Module> module) {
   int cnt = 0;
   for (auto& func : module->m_funcs) {
@@ -211,7 +297,7 @@ void eliminateDeadInstruction(std::shared_ptr<ASM_Module> module) {
           }
           continue;
         }
-        bool is_used = inst->m_def.empty();
+        bool is_used = inst->m_def.empty() || inst->m_set_flag;
         for (auto& def : inst->m_def) {
           if (live.find(def) != live.end()
               || def->m_op_type != OperandType::VREG) {
@@ -227,22 +313,208 @@ void eliminateDeadInstruction(std::shared_ptr<ASM_Module> module) {
         for (auto& use : inst->m_use) {
           live.insert(use);
         }
+        // a conditional def keeps the old value when not executed
+        if (inst->m_cond != CondType::NONE) {
+          for (auto& def : inst->m_def) {
+            live.insert(def);
+          }
+        }
       }
     }
   }
   std::cerr << "[debug] remove dead instruction x" << cnt << std::endl;
 }
 
+// instructions of a block that can be predicated, -1 if any of them can't
+int countPredicable(std::shared_ptr<ASM_BasicBlock> block) {
+  int cnt = 0;
+  for (auto iter = block->m_insts.begin(); iter != block->m_branch_pos;
+       iter++) {
+    auto& inst = *iter;
+    if (inst->m_is_deleted) continue;
+    // must not change or depend on another condition
+    if (inst->m_cond != CondType::NONE || inst->m_set_flag) return -1;
+    switch (inst->m_op) {
+      case InstOp::CMP:
+      case InstOp::TST:
+      case InstOp::VCMP:
+      case InstOp::B:
+      case InstOp::BL:
+      case InstOp::STR:
+      case InstOp::VSTR:
+      case InstOp::STRD:
+      case InstOp::STM:
+      case InstOp::VSTM:
+      case InstOp::PUSH:
+      case InstOp::POP:
+      case InstOp::VPUSH:
+      case InstOp::VPOP:
+        return -1;
+      default:
+        break;
+    }
+    // MOVW + MOVT
+    auto mov = std::dynamic_pointer_cast<MOVInst>(inst);
+    auto ldr = std::dynamic_pointer_cast<LDRInst>(inst);
+    if (mov && mov->m_src->m_op_type == OperandType::IMM
+        && !mov->m_src->m_is_float && !Operand::immCheck(mov->m_src->m_int_val)
+        && !Operand::immCheck(~mov->m_src->m_int_val))
+      cnt++;
+    else if (ldr && ldr->m_type == LDRInst::Type::LABEL)
+      cnt++;
+    cnt++;
+  }
+  return cnt;
+}
+
+void predicateBlock(std::shared_ptr<ASM_BasicBlock> block,
+                    std::shared_ptr<ASM_BasicBlock> head, CondType cond) {
+  for (auto iter = block->m_insts.begin(); iter != block->m_branch_pos;
+       iter++) {
+    auto& inst = *iter;
+    if (inst->m_is_deleted) continue;
+    inst->m_cond = cond;
+    inst->m_block = head;
+    head->m_insts.insert(head->m_branch_pos, inst);
+  }
+}
+
+// turn small triangles and diamonds after a conditional branch into
+// predicated instructions:
+//   head: Bcc then; B else        head: ...(cc); ...(!cc)
+//   then: ...; B join         =>        B join
+//   else: ...; B join
+void ifConversion(std::shared_ptr<ASM_Module> module) {
+  int cnt = 0;
+  for (auto& func : module->m_funcs) {
+    // the block reached by a block without a tail B
+    auto fallThrough = [&](std::shared_ptr<ASM_BasicBlock> block) {
+      auto iter = std::find(func->m_blocks.begin(), func->m_blocks.end(), block);
+      iter++;
+      return iter == func->m_blocks.end() ? nullptr : *iter;
+    };
+    // the only successor of a block ending with nothing or one B
+    auto onlySuccessor = [&](std::shared_ptr<ASM_BasicBlock> block)
+        -> std::shared_ptr<ASM_BasicBlock> {
+      if (block->m_branch_pos == block->m_insts.end())
+        return fallThrough(block);
+      auto b = std::dynamic_pointer_cast<BInst>(*block->m_branch_pos);
+      if (!b || b->m_cond != CondType::NONE
+          || std::next(block->m_branch_pos) != block->m_insts.end())
+        return nullptr;
+      return b->m_target;
+    };
+    auto isArm = [&](std::shared_ptr<ASM_BasicBlock> block,
+                     std::shared_ptr<ASM_BasicBlock> head) {
+      return block != func->m_blocks.front() && block != func->m_rblock
+             && block != head && block->m_predecessors.size() == 1
+             && block->m_predecessors.front() == head;
+    };
+
+    bool flag = true;
+    while (flag) {
+      flag = false;
+      for (auto& head : func->m_blocks) {
+        if (head->m_branch_pos == head->m_insts.end()) continue;
+        auto br = std::dynamic_pointer_cast<BInst>(*head->m_branch_pos);
+        if (!br || br->m_cond == CondType::NONE) continue;
+        auto then_block = br->m_target;
+        std::shared_ptr<ASM_BasicBlock> else_block;
+        auto next = std::next(head->m_branch_pos);
+        if (next == head->m_insts.end()) {
+          else_block = fallThrough(head);
+        } else {
+          auto b = std::dynamic_pointer_cast<BInst>(*next);
+          if (!b || b->m_cond != CondType::NONE
+              || std::next(next) != head->m_insts.end())
+            continue;
+          else_block = b->m_target;
+        }
+        if (!else_block || then_block == else_block) continue;
+
+        CondType cond = br->m_cond;
+        std::shared_ptr<ASM_BasicBlock> join;
+        std::vector<std::shared_ptr<ASM_BasicBlock>> arms;
+        std::vector<CondType> conds;
+        bool then_arm = isArm(then_block, head);
+        bool else_arm = isArm(else_block, head);
+        int then_cnt = then_arm ? countPredicable(then_block) : -1;
+        int else_cnt = else_arm ? countPredicable(else_block) : -1;
+        if (then_cnt >= 0 && else_cnt >= 0
+            && then_cnt + else_cnt <= IF_CONVERSION_LIMIT
+            && onlySuccessor(then_block)
+            && onlySuccessor(then_block) == onlySuccessor(else_block)) {
+          // diamond
+          join = onlySuccessor(then_block);
+          arms = {then_block, else_block};
+          conds = {cond, getOppositeCond(cond)};
+        } else if (then_cnt >= 0 && then_cnt <= IF_CONVERSION_LIMIT
+                   && onlySuccessor(then_block) == else_block) {
+          // triangle
+          join = else_block;
+          arms = {then_block};
+          conds = {cond};
+        } else if (else_cnt >= 0 && else_cnt <= IF_CONVERSION_LIMIT
+                   && onlySuccessor(else_block) == then_block) {
+          join = then_block;
+          arms = {else_block};
+          conds = {getOppositeCond(cond)};
+        } else {
+          continue;
+        }
+        if (join == head) continue;
+
+        for (int i = 0; i < arms.size(); i++) {
+          predicateBlock(arms[i], head, conds[i]);
+        }
+        head->m_insts.erase(head->m_branch_pos, head->m_insts.end());
+        head->m_insts.push_back(std::make_shared<BInst>(join));
+        head->m_branch_pos = std::prev(head->m_insts.end());
+        head->m_insts.back()->m_block = head;
+        head->removeSuccessor(then_block);
+        head->removeSuccessor(else_block);
+        head->appendSuccessor(join);
+        for (auto& arm : arms) {
+          join->removePredecessor(arm);
+          func->m_blocks.remove(arm);
+        }
+        join->removePredecessor(head);
+        join->appendPredecessor(head);
+        if (fallThrough(head) == join) {
+          head->m_insts.pop_back();
+          head->m_branch_pos = head->m_insts.end();
+        }
+        cnt++;
+        flag = true;
+        break;
+      }
+    }
+  }
+  std::cerr << "[debug] if-conversion x" << cnt << std::endl;
+}
+
 void optimizeTemp(std::shared_ptr<ASM_Module> module, bool optimization) {
+  if (optimization) layoutBlocks(module);
   eliminateRedundantJump(module);
   removeUnreachableBlock(module);
 
   if (optimization) {
     combineInstruction(module);
+    combineAddressing(module);
+    peephole(module, false);
     eliminateDeadInstruction(module);
+    pipelineLoops(module);
+    scheduleInstruction(module, false);
+    splitLiveRanges(module);
   }
 }
 
-void optimize(std::shared_ptr<ASM_Module> module) {
+void optimize(std::shared_ptr<ASM_Module> module, bool optimization) {
   eliminateRedundantMOV(module);
+
+  if (optimization) {
+    peephole(module, true);
+    ifConversion(module);
+    scheduleInstruction(module, true);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,590 @@
+//
+// peephole rewrites, run before register allocation on virtual registers and
+// after it on physical ones
+//
+// each pattern is a rule tried at every instruction of a block, looking ahead
+// at most PEEPHOLE_WINDOW instructions. a new pattern is a rule and a line in
+// the table below, and the hits of every pattern are reported
+//
+
+#include "asm/asm-peephole.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "asm/asm-schedule.h"
+
+typedef std::shared_ptr<Operand> OpPtr;
+typedef std::shared_ptr<ASM_BasicBlock> BlockPtr;
+typedef std::shared_ptr<ASM_Instruction> InstPtr;
+
+// the key of the flags in a RegSet, after those of r0-r15 and s0-s31
+static const uintptr_t FLAGS_KEY = 48;
+
+static uintptr_t getRegKey(OpPtr op) {
+  if (op->m_op_type == OperandType::VREG) return (uintptr_t)op.get();
+  if (op->getRegType() == RegType::R) return (uintptr_t)op->m_rreg;
+  return 16 + (uintptr_t)op->m_sreg;
+}
+
+static bool isReg(OpPtr op) {
+  return op && op->m_op_type != OperandType::IMM;
+}
+
+// physical registers are compared by number, the allocator colors virtual
+// registers in place
+static bool isSameReg(OpPtr a, OpPtr b) {
+  return isReg(a) && isReg(b) && getRegKey(a) == getRegKey(b);
+}
+
+static bool isUsed(InstPtr inst, OpPtr reg) {
+  for (auto& uses : {inst->m_use, inst->m_f_use})
+    for (auto& use : uses)
+      if (isSameReg(use, reg)) return true;
+  return false;
+}
+
+static bool isDefined(InstPtr inst, OpPtr reg) {
+  for (auto& defs : {inst->m_def, inst->m_f_def})
+    for (auto& def : defs)
+      if (isSameReg(def, reg)) return true;
+  return false;
+}
+
+static bool setsFlags(InstPtr inst) {
+  return inst->m_set_flag || inst->m_op == InstOp::CMP
+         || inst->m_op == InstOp::TST || inst->m_op == InstOp::VCMP
+         || inst->m_op == InstOp::BL;
+}
+
+// whether the value of reg right before iter is never read
+static bool isDeadAt(BlockPtr block, InstIter iter, OpPtr reg,
+                     const RegSet& live_out) {
+  if (reg->m_op_type == OperandType::REG && reg->getRegType() == RegType::R
+      && (reg->m_rreg == RReg::SP || reg->m_rreg == RReg::LR
+          || reg->m_rreg == RReg::PC))
+    return false;
+  for (; iter != block->m_insts.end(); iter++) {
+    auto inst = *iter;
+    if (inst->m_is_deleted) continue;
+    if (isUsed(inst, reg)) return false;
+    if (inst->m_cond == CondType::NONE && isDefined(inst, reg)) return true;
+  }
+  return live_out.find(getRegKey(reg)) == live_out.end();
+}
+
+static void replaceInst(BlockPtr block, InstIter iter, InstPtr inst) {
+  inst->m_cond = (*iter)->m_cond;
+  inst->m_block = block;
+  *iter = inst;
+}
+
+// STR src, [base, #offs]; ...; LDR dest, [base, #offs] => ...; MOV dest, src
+static bool forwardStore(BlockPtr block, InstIter iter, const RegSet&) {
+  auto str = std::dynamic_pointer_cast<STRInst>(*iter);
+  if (!str || str->m_cond != CondType::NONE || str->m_shift
+      || str->m_offs->m_op_type != OperandType::IMM)
+    return false;
+  int offs = str->m_offs->m_int_val;
+  int cnt = 0;
+  for (auto next = std::next(iter);
+       next != block->m_insts.end() && cnt < PEEPHOLE_WINDOW; next++) {
+    auto inst = *next;
+    if (inst->m_is_deleted) continue;
+    cnt++;
+    auto ldr = std::dynamic_pointer_cast<LDRInst>(inst);
+    if (ldr && ldr->m_type == LDRInst::Type::REG && !ldr->m_shift
+        && isSameReg(ldr->m_src, str->m_dest)
+        && ldr->m_offs->m_op_type == OperandType::IMM
+        && ldr->m_offs->m_int_val == offs
+        && ldr->m_params_offset == str->m_params_offset
+        && ldr->m_dest->m_is_float == str->m_src->m_is_float) {
+      if (isSameReg(ldr->m_dest, str->m_src) && ldr->m_cond == CondType::NONE)
+        ldr->m_is_deleted = true;
+      else
+        replaceInst(block, next, std::make_shared<MOVInst>(ldr->m_dest,
+                                                           str->m_src));
+      return true;
+    }
+    // only stores to other words of the same base are known not to overlap
+    if (auto other = std::dynamic_pointer_cast<STRInst>(inst)) {
+      if (other->m_shift || !isSameReg(other->m_dest, str->m_dest)
+          || other->m_offs->m_op_type != OperandType::IMM
+          || other->m_params_offset != str->m_params_offset
+          || std::abs(other->m_offs->m_int_val - offs) < 4)
+        return false;
+    } else if (inst->m_op == InstOp::BL || inst->m_op == InstOp::PUSH
+               || inst->m_op == InstOp::VPUSH) {
+      return false;
+    }
+    if (isDefined(inst, str->m_src) || isDefined(inst, str->m_dest))
+      return false;
+  }
+  return false;
+}
+
+// MOV b, a; ...; MOV c, b => MOV b, a; ...; MOV c, a
+// and the first MOV goes if b is no longer read, MOV a, b goes at all
+static bool propagateCopy(BlockPtr block, InstIter iter,
+                          const RegSet& live_out) {
+  auto mov = std::dynamic_pointer_cast<MOVInst>(*iter);
+  if (!mov || mov->m_cond != CondType::NONE || mov->m_type != MOVType::REG
+      || isSameReg(mov->m_dest, mov->m_src))
+    return false;
+  auto dest = mov->m_dest;
+  auto src = mov->m_src;
+  bool changed = false;
+  int cnt = 0;
+  for (auto next = std::next(iter);
+       next != block->m_insts.end() && cnt < PEEPHOLE_WINDOW; next++) {
+    auto inst = *next;
+    if (inst->m_is_deleted) continue;
+    cnt++;
+    auto copy = std::dynamic_pointer_cast<MOVInst>(inst);
+    if (copy && copy->m_type == MOVType::REG
+        && isSameReg(copy->m_src, dest)) {
+      if (isSameReg(copy->m_dest, src))
+        copy->m_is_deleted = true;
+      else
+        replaceInst(block, next, std::make_shared<MOVInst>(copy->m_dest, src));
+      changed = true;
+      inst = *next;
+    }
+    if (isDefined(inst, dest) || isDefined(inst, src)) break;
+  }
+  if (!changed) return false;
+  if (isDeadAt(block, std::next(iter), dest, live_out))
+    mov->m_is_deleted = true;
+  return true;
+}
+
+// SUB r, a, b; CMP r, #0 => SUBS r, a, b
+// if the flags are only tested for equality, as the C and V flags differ
+static bool mergeCompare(BlockPtr block, InstIter iter,
+                         const RegSet& live_out) {
+  auto inst = *iter;
+  OpPtr dest;
+  if (auto as = std::dynamic_pointer_cast<ASInst>(inst)) {
+    if (inst->m_op != InstOp::ADD && inst->m_op != InstOp::SUB
+        && inst->m_op != InstOp::RSB)
+      return false;
+    dest = as->m_dest;
+  } else if (auto bit = std::dynamic_pointer_cast<BITInst>(inst)) {
+    if (inst->m_op == InstOp::MVN) return false;
+    dest = bit->m_dest;
+  } else {
+    return false;
+  }
+  if (inst->m_cond != CondType::NONE || inst->m_set_flag) return false;
+
+  // the CMP may be a few instructions away, past none touching the flags
+  auto next = std::next(iter);
+  int cnt = 0;
+  for (; next != block->m_insts.end() && cnt < PEEPHOLE_WINDOW; next++) {
+    if ((*next)->m_is_deleted) continue;
+    cnt++;
+    if ((*next)->m_op == InstOp::CMP || (*next)->m_cond != CondType::NONE
+        || setsFlags(*next) || isDefined(*next, dest))
+      break;
+  }
+  if (next == block->m_insts.end()) return false;
+  auto cmp = std::dynamic_pointer_cast<CTInst>(*next);
+  if (!cmp || cmp->m_op != InstOp::CMP || cmp->m_cond != CondType::NONE
+      || cmp->m_shift || !isSameReg(cmp->m_operand1, dest)
+      || cmp->m_operand2->m_op_type != OperandType::IMM
+      || cmp->m_operand2->m_int_val != 0)
+    return false;
+  bool redefined = false;
+  for (auto user = std::next(next); user != block->m_insts.end(); user++) {
+    if ((*user)->m_is_deleted) continue;
+    if ((*user)->m_cond != CondType::NONE && (*user)->m_cond != CondType::EQ
+        && (*user)->m_cond != CondType::NE)
+      return false;
+    if (setsFlags(*user)) {
+      redefined = true;
+      break;
+    }
+  }
+  // the successors may test any of them
+  if (!redefined && live_out.find(FLAGS_KEY) != live_out.end()) return false;
+  inst->m_set_flag = true;
+  cmp->m_is_deleted = true;
+  return true;
+}
+
+// MUL t, a, b; ...; ADD d, c, t => ...; MLA d, a, b, c
+// t is dead after the ADD, so it may as well be a or b
+static bool fuseMLA(BlockPtr block, InstIter iter, const RegSet& live_out) {
+  auto mul = std::dynamic_pointer_cast<MULInst>(*iter);
+  if (!mul || mul->m_op != InstOp::MUL || mul->m_cond != CondType::NONE
+      || mul->m_set_flag)
+    return false;
+  auto tmp = mul->m_dest;
+  int cnt = 0;
+  for (auto next = std::next(iter);
+       next != block->m_insts.end() && cnt < PEEPHOLE_WINDOW; next++) {
+    auto inst = *next;
+    if (inst->m_is_deleted) continue;
+    cnt++;
+    auto add = std::dynamic_pointer_cast<ASInst>(inst);
+    if (add && add->m_op == InstOp::ADD && add->m_cond == CondType::NONE
+        && !add->m_set_flag && !add->m_shift) {
+      OpPtr acc;
+      if (isSameReg(add->m_operand2, tmp))
+        acc = add->m_operand1;
+      else if (isSameReg(add->m_operand1, tmp))
+        acc = add->m_operand2;
+      if (acc && isReg(acc) && !isSameReg(acc, tmp)) {
+        bool is_dead = isSameReg(add->m_dest, tmp)
+                       || isDeadAt(block, std::next(next), tmp, live_out);
+        // before allocation the MUL may stay for its other uses, it is left
+        // to eliminateDeadInstruction once they are fused too
+        if (!is_dead
+            && (tmp->m_op_type != OperandType::VREG
+                || isSameReg(mul->m_operand1, tmp)
+                || isSameReg(mul->m_operand2, tmp)))
+          return false;
+        replaceInst(block, next,
+                    std::make_shared<MULInst>(InstOp::MLA, add->m_dest,
+                                              mul->m_operand1,
+                                              mul->m_operand2, acc));
+        if (is_dead) mul->m_is_deleted = true;
+        return true;
+      }
+    }
+    if (isUsed(inst, tmp) || isDefined(inst, tmp)
+        || isDefined(inst, mul->m_operand1)
+        || isDefined(inst, mul->m_operand2))
+      return false;
+  }
+  return false;
+}
+
+// instructions since reg was set before iter, around the loop if it is set
+// later in block, or INT_MAX outside loops
+static int getDefDistance(BlockPtr block, InstIter iter, OpPtr reg) {
+  int dist = 0;
+  for (auto i = std::make_reverse_iterator(iter); i != block->m_insts.rend();
+       i++) {
+    if ((*i)->m_is_deleted) continue;
+    dist++;
+    if (isDefined(*i, reg)) return dist;
+  }
+  if (!block->m_loop_depth) return INT_MAX;
+  for (auto i = iter; i != block->m_insts.end(); i++)
+    if (!(*i)->m_is_deleted) dist++;
+  return dist;
+}
+
+// VMUL t, a, b; ...; VADD d, d, t => ...; VMLA d, a, b
+// VMLA rounds the product as VMUL does, so the result is the same. it takes
+// VMLA_LATENCY to d instead of VFP_LATENCY, so only if d has long been ready
+static bool fuseVMLA(BlockPtr block, InstIter iter, const RegSet& live_out) {
+  auto mul = std::dynamic_pointer_cast<MULInst>(*iter);
+  if (!mul || mul->m_op != InstOp::VMUL || mul->m_cond != CondType::NONE)
+    return false;
+  auto tmp = mul->m_dest;
+  int cnt = 0;
+  for (auto next = std::next(iter);
+       next != block->m_insts.end() && cnt < PEEPHOLE_WINDOW; next++) {
+    auto inst = *next;
+    if (inst->m_is_deleted) continue;
+    cnt++;
+    auto add = std::dynamic_pointer_cast<ASInst>(inst);
+    if (add && add->m_op == InstOp::VADD && add->m_cond == CondType::NONE) {
+      auto dest = add->m_dest;
+      bool match = (isSameReg(add->m_operand1, dest)
+                    && isSameReg(add->m_operand2, tmp))
+                   || (isSameReg(add->m_operand2, dest)
+                       && isSameReg(add->m_operand1, tmp));
+      if (match && !isSameReg(dest, tmp)
+          && isDeadAt(block, std::next(next), tmp, live_out)
+          && getDefDistance(block, next, dest) >= VMLA_LATENCY) {
+        auto vmla = std::make_shared<MULInst>(InstOp::VMLA, dest,
+                                              mul->m_operand1, mul->m_operand2);
+        // the accumulator of VMLA is its dest
+        vmla->addUse(dest);
+        replaceInst(block, next, vmla);
+        mul->m_is_deleted = true;
+        return true;
+      }
+    }
+    if (isUsed(inst, tmp) || isDefined(inst, tmp)
+        || isDefined(inst, mul->m_operand1)
+        || isDefined(inst, mul->m_operand2))
+      return false;
+  }
+  return false;
+}
+
+// a load or store of one register at base + #offs
+static bool getMemAccess(InstPtr inst, OpPtr& reg, OpPtr& base, int& offs) {
+  if (inst->m_cond != CondType::NONE) return false;
+  OpPtr offs_op;
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+    if (ldr->m_type != LDRInst::Type::REG || ldr->m_shift) return false;
+    reg = ldr->m_dest;
+    base = ldr->m_src;
+    offs_op = ldr->m_offs;
+  } else if (auto str = std::dynamic_pointer_cast<STRInst>(inst)) {
+    if (str->m_shift) return false;
+    reg = str->m_src;
+    base = str->m_dest;
+    offs_op = str->m_offs;
+  } else {
+    return false;
+  }
+  if (offs_op->m_op_type != OperandType::IMM) return false;
+  offs = offs_op->m_int_val;
+  return true;
+}
+
+static bool isLoad(InstPtr inst) {
+  switch (inst->m_op) {
+    case InstOp::LDR:
+      return std::dynamic_pointer_cast<LDRInst>(inst)->m_type
+             == LDRInst::Type::REG;
+    case InstOp::VLDR:
+    case InstOp::LDRD:
+    case InstOp::LDM:
+    case InstOp::VLDM:
+    case InstOp::POP:
+    case InstOp::VPOP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool accessesMemory(InstPtr inst) {
+  switch (inst->m_op) {
+    case InstOp::STR:
+    case InstOp::VSTR:
+    case InstOp::STRD:
+    case InstOp::STM:
+    case InstOp::VSTM:
+    case InstOp::PUSH:
+    case InstOp::VPUSH:
+    case InstOp::BL:
+      return true;
+    default:
+      return isLoad(inst);
+  }
+}
+
+struct MemAccess {
+  int m_pos;
+  OpPtr m_reg;
+  int m_offs;
+};
+
+// the instruction doing the accesses (sorted by offset) at once, B if none
+static InstOp getMultipleOp(std::vector<MemAccess>& run, InstOp op) {
+  int n = run.size();
+  int offs = run.front().m_offs;
+  if (offs % 4) return InstOp::B;
+  if (op == InstOp::VLDR || op == InstOp::VSTR) {
+    // a range of s registers from the base
+    for (int i = 1; i < n; i++)
+      if ((int)run[i].m_reg->m_sreg != (int)run[0].m_reg->m_sreg + i)
+        return InstOp::B;
+    if (offs != 0) return InstOp::B;
+    return op == InstOp::VLDR ? InstOp::VLDM : InstOp::VSTM;
+  }
+  int first = (int)run[0].m_reg->m_rreg;
+  // an even register but lr and the next one, within 255 bytes
+  if (n == 2 && first % 2 == 0 && first < (int)RReg::R12
+      && (int)run[1].m_reg->m_rreg == first + 1 && offs >= -255
+      && offs <= 255)
+    return op == InstOp::LDR ? InstOp::LDRD : InstOp::STRD;
+  // ascending registers from base, base + 4, or up to base - 4
+  for (int i = 0; i < n; i++) {
+    auto reg = run[i].m_reg->m_rreg;
+    if (reg == RReg::SP || reg == RReg::PC) return InstOp::B;
+    if (i && reg <= run[i - 1].m_reg->m_rreg) return InstOp::B;
+  }
+  if (offs != 0 && offs != 4 && offs + 4 * n != 0) return InstOp::B;
+  return op == InstOp::LDR ? InstOp::LDM : InstOp::STM;
+}
+
+// LDR r4, [b, #8]; ...; LDR r5, [b, #12] => LDRD r4, r5, [b, #8]; ...
+// and LDM/STM/VLDM/VSTM for longer runs. loads move up to the first one,
+// stores down to the last one
+static bool pairLoadStore(BlockPtr block, InstIter iter, const RegSet&) {
+  auto first = *iter;
+  OpPtr reg, base;
+  int offs;
+  if (!getMemAccess(first, reg, base, offs)) return false;
+  bool is_load = isLoad(first);
+
+  std::vector<InstIter> insts{iter};
+  std::vector<MemAccess> accs{{0, reg, offs}};
+  for (auto next = std::next(iter);
+       next != block->m_insts.end() && insts.size() <= PEEPHOLE_WINDOW;
+       next++) {
+    auto inst = *next;
+    if (inst->m_is_deleted) continue;
+    OpPtr other_reg, other_base;
+    int other_offs;
+    if (inst->m_op == first->m_op
+        && getMemAccess(inst, other_reg, other_base, other_offs)
+        && isSameReg(other_base, base)
+        && std::none_of(accs.begin(), accs.end(), [&](MemAccess& acc) {
+             return acc.m_offs == other_offs;
+           }))
+      accs.push_back({(int)insts.size(), other_reg, other_offs});
+    else if (accessesMemory(inst) && !(is_load && isLoad(inst)))
+      break;
+    insts.push_back(next);
+    if (isDefined(inst, base)) break;
+  }
+  if (accs.size() < 2) return false;
+  std::sort(accs.begin(), accs.end(), [](MemAccess& a, MemAccess& b) {
+    return a.m_offs < b.m_offs;
+  });
+
+  auto canMove = [&](std::vector<MemAccess>& run) {
+    int last = 0;
+    for (auto& acc : run) last = std::max(last, acc.m_pos);
+    for (auto& acc : run) {
+      if (is_load) {
+        for (int p = 0; p < acc.m_pos; p++) {
+          auto inst = *insts[p];
+          if (isUsed(inst, acc.m_reg) || isDefined(inst, acc.m_reg)
+              || isDefined(inst, base))
+            return false;
+        }
+      } else {
+        for (int p = acc.m_pos + 1; p <= last; p++) {
+          auto inst = *insts[p];
+          if (isDefined(inst, acc.m_reg) || isDefined(inst, base))
+            return false;
+        }
+      }
+    }
+    return true;
+  };
+
+  int anchor = std::find_if(accs.begin(), accs.end(),
+                            [](MemAccess& acc) { return acc.m_pos == 0; })
+               - accs.begin();
+  for (int len = accs.size(); len >= 2; len--) {
+    for (int l = std::max(0, anchor - len + 1);
+         l <= anchor && l + len <= accs.size(); l++) {
+      std::vector<MemAccess> run(accs.begin() + l, accs.begin() + l + len);
+      bool is_consecutive = true;
+      for (int i = 1; i < len; i++)
+        if (run[i].m_offs != run[i - 1].m_offs + 4) is_consecutive = false;
+      if (!is_consecutive) continue;
+      InstOp op = getMultipleOp(run, first->m_op);
+      if (op == InstOp::B || !canMove(run)) continue;
+
+      std::vector<OpPtr> regs;
+      int pos = 0;
+      for (auto& acc : run) {
+        regs.push_back(acc.m_reg);
+        pos = std::max(pos, acc.m_pos);
+      }
+      if (is_load) pos = 0;
+      bool is_spill = true;
+      for (auto& acc : run) {
+        is_spill &= (*insts[acc.m_pos])->m_is_spill;
+        (*insts[acc.m_pos])->m_is_deleted = true;
+      }
+      auto lsm = std::make_shared<LSMInst>(op, regs, base, run.front().m_offs);
+      lsm->m_is_spill = is_spill;
+      replaceInst(block, insts[pos], lsm);
+      return true;
+    }
+  }
+  return false;
+}
+
+// VMLA reads its dest, which spilling doesn't rewrite, so it is post-RA only.
+// copies of virtual registers are left to coalescing
+static const std::vector<PeepholePattern> patterns = {
+    {"store-to-load", false, true, forwardStore},
+    {"copy", false, true, propagateCopy},
+    {"compare", true, true, mergeCompare},
+    {"mla", true, true, fuseMLA},
+    {"vmla", false, true, fuseVMLA},
+    {"pair", false, true, pairLoadStore},
+};
+
+// live registers and flags at the end of each block, r0-r15 and s0-s15 at
+// the return
+static std::unordered_map<BlockPtr, RegSet> getLiveOut(
+    std::shared_ptr<ASM_Function> func) {
+  std::unordered_map<BlockPtr, RegSet> live_in, live_out, use, def;
+  for (auto& block : func->m_blocks) {
+    for (auto& inst : block->m_insts) {
+      if (inst->m_is_deleted) continue;
+      for (auto& uses : {inst->m_use, inst->m_f_use})
+        for (auto& u : uses)
+          if (def[block].find(getRegKey(u)) == def[block].end())
+            use[block].insert(getRegKey(u));
+      if (inst->m_cond != CondType::NONE
+          && def[block].find(FLAGS_KEY) == def[block].end())
+        use[block].insert(FLAGS_KEY);
+      if (setsFlags(inst)) def[block].insert(FLAGS_KEY);
+      // a conditional def keeps the old value when not executed
+      for (auto& defs : {inst->m_def, inst->m_f_def})
+        for (auto& d : defs) {
+          if (inst->m_cond != CondType::NONE
+              && def[block].find(getRegKey(d)) == def[block].end())
+            use[block].insert(getRegKey(d));
+          def[block].insert(getRegKey(d));
+        }
+    }
+  }
+  RegSet exit;
+  for (int i = 0; i < 16; i++) {
+    exit.insert(getRegKey(Operand::getRReg((RReg)i)));
+    exit.insert(getRegKey(Operand::getSReg((SReg)i)));
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto iter = func->m_blocks.rbegin(); iter != func->m_blocks.rend();
+         iter++) {
+      auto block = *iter;
+      RegSet out;
+      if (block->m_successors.empty()) out = exit;
+      for (auto& succ : block->m_successors)
+        out.insert(live_in[succ].begin(), live_in[succ].end());
+      RegSet in = use[block];
+      for (auto& reg : out)
+        if (def[block].find(reg) == def[block].end()) in.insert(reg);
+      if (in != live_in[block] || out != live_out[block]) {
+        live_in[block] = in;
+        live_out[block] = out;
+        changed = true;
+      }
+    }
+  }
+  return live_out;
+}
+
+void peephole(std::shared_ptr<ASM_Module> module, bool post_ra) {
+  std::vector<int> cnt(patterns.size());
+  for (auto& func : module->m_funcs) {
+    auto live_out = getLiveOut(func);
+    for (auto& block : func->m_blocks) {
+      for (auto iter = block->m_insts.begin(); iter != block->m_insts.end();
+           iter++) {
+        for (int i = 0; i < patterns.size(); i++) {
+          auto& pattern = patterns[i];
+          if (post_ra ? !pattern.m_post_ra : !pattern.m_pre_ra) continue;
+          while (!(*iter)->m_is_deleted
+                 && pattern.m_rule(block, iter, live_out[block]))
+            cnt[i]++;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < patterns.size(); i++) {
+    if (post_ra ? !patterns[i].m_post_ra : !patterns[i].m_pre_ra) continue;
+    std::cerr << "[debug] peephole " << patterns[i].m_name << " x" << cnt[i]
+              << std::endl;
+  }
+}
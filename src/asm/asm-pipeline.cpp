@@ -0,0 +1,523 @@
+//
+// software pipelining of single-block loops by iterative modulo scheduling
+//
+//   head: ...; CMP; Bcc exit        head:     ...; CMP; Bcc exit
+//   body: ...; B head          =>   prologue: stage 0 of iteration 0
+//                                             Bcc epilogue
+//                                   kernel:   stage 0 of i + 1, stage 1 of i
+//                                             Bcc kernel
+//                                   epilogue: stage 1 of the last iteration
+//                                             B exit
+//
+// one iteration is the body followed by a copy of the head, the head itself
+// stays as the guard of the first iteration. the compare must be in stage 0,
+// so nothing is executed speculatively
+//
+
+#include "asm/asm-pipeline.h"
+
+#include <algorithm>
+
+#include "asm/asm-schedule.h"
+
+typedef std::shared_ptr<Operand> OpPtr;
+typedef std::shared_ptr<ASM_Instruction> InstPtr;
+
+struct PipelineEdge {
+  int node;
+  int latency;
+  int distance;  // in iterations
+};
+
+std::unique_ptr<Shift> cloneShift(const std::unique_ptr<Shift>& shift) {
+  if (!shift) return nullptr;
+  return std::make_unique<Shift>(shift->s_type, shift->s_val);
+}
+
+// nullptr if the instruction can't be copied
+std::shared_ptr<ASM_Instruction> cloneInstruction(
+    std::shared_ptr<ASM_Instruction> inst) {
+  InstPtr ret;
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+    std::shared_ptr<LDRInst> clone;
+    if (ldr->m_type == LDRInst::Type::LABEL)
+      clone = std::make_shared<LDRInst>(ldr->m_dest, ldr->m_label);
+    else
+      clone = std::make_shared<LDRInst>(ldr->m_dest, ldr->m_src, ldr->m_offs);
+    clone->m_shift = cloneShift(ldr->m_shift);
+    ret = clone;
+  } else if (auto str = std::dynamic_pointer_cast<STRInst>(inst)) {
+    auto clone
+        = std::make_shared<STRInst>(str->m_src, str->m_dest, str->m_offs);
+    clone->m_shift = cloneShift(str->m_shift);
+    ret = clone;
+  } else if (auto mov = std::dynamic_pointer_cast<MOVInst>(inst)) {
+    ret = std::make_shared<MOVInst>(mov->m_dest, mov->m_src);
+  } else if (auto shift = std::dynamic_pointer_cast<ShiftInst>(inst)) {
+    ret = std::make_shared<ShiftInst>(shift->m_op, shift->m_dest,
+                                      shift->m_src, shift->m_sval);
+  } else if (auto as = std::dynamic_pointer_cast<ASInst>(inst)) {
+    auto clone = std::make_shared<ASInst>(as->m_op, as->m_dest,
+                                          as->m_operand1, as->m_operand2);
+    clone->m_shift = cloneShift(as->m_shift);
+    ret = clone;
+  } else if (auto mul = std::dynamic_pointer_cast<MULInst>(inst)) {
+    ret = std::make_shared<MULInst>(mul->m_op, mul->m_dest, mul->m_operand1,
+                                    mul->m_operand2, mul->m_append);
+  } else if (auto sdiv = std::dynamic_pointer_cast<SDIVInst>(inst)) {
+    ret = std::make_shared<SDIVInst>(sdiv->m_dest, sdiv->m_devidend,
+                                     sdiv->m_devisor);
+  } else if (auto vcvt = std::dynamic_pointer_cast<VCVTInst>(inst)) {
+    ret = std::make_shared<VCVTInst>(vcvt->m_type, vcvt->m_dest, vcvt->m_src);
+  } else if (auto bit = std::dynamic_pointer_cast<BITInst>(inst)) {
+    std::shared_ptr<BITInst> clone;
+    if (bit->m_operand2)
+      clone = std::make_shared<BITInst>(bit->m_op, bit->m_dest,
+                                        bit->m_operand1, bit->m_operand2);
+    else
+      clone = std::make_shared<BITInst>(bit->m_op, bit->m_dest,
+                                        bit->m_operand1);
+    clone->m_shift = cloneShift(bit->m_shift);
+    ret = clone;
+  } else if (auto ct = std::dynamic_pointer_cast<CTInst>(inst)) {
+    auto clone = std::make_shared<CTInst>(ct->m_op, ct->m_operand1,
+                                          ct->m_operand2);
+    clone->m_shift = cloneShift(ct->m_shift);
+    ret = clone;
+  } else if (auto vneg = std::dynamic_pointer_cast<VNEGInst>(inst)) {
+    ret = std::make_shared<VNEGInst>(vneg->m_dest, vneg->m_operand);
+  } else {
+    return nullptr;
+  }
+  ret->m_op = inst->m_op;
+  ret->m_cond = inst->m_cond;
+  ret->m_set_flag = inst->m_set_flag;
+  return ret;
+}
+
+bool isCompare(InstPtr inst) {
+  return inst->m_op == InstOp::CMP || inst->m_op == InstOp::TST
+         || inst->m_op == InstOp::VCMP;
+}
+
+bool isMemoryAccess(InstPtr inst) {
+  if (inst->m_op == InstOp::STR || inst->m_op == InstOp::VSTR) return true;
+  auto ldr = std::dynamic_pointer_cast<LDRInst>(inst);
+  return ldr && ldr->m_type == LDRInst::Type::REG;
+}
+
+// the array an address is based on: a global label, the stack, or "" if it
+// is unknown and may alias anything
+std::string getAddressBase(
+    OpPtr op, std::unordered_map<OpPtr, std::vector<InstPtr>>& def_map,
+    int depth = 0) {
+  if (op->m_op_type == OperandType::REG)
+    return op->m_rreg == RReg::SP ? "sp" : "";
+  if (op->m_op_type != OperandType::VREG || depth > 8) return "";
+  if (def_map[op].size() != 1) return "";
+  auto def = def_map[op].front();
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(def)) {
+    if (ldr->m_type == LDRInst::Type::LABEL) return ldr->m_label;
+  } else if (auto as = std::dynamic_pointer_cast<ASInst>(def)) {
+    if (as->m_op == InstOp::ADD || as->m_op == InstOp::SUB)
+      return getAddressBase(as->m_operand1, def_map, depth + 1);
+  } else if (auto mov = std::dynamic_pointer_cast<MOVInst>(def)) {
+    if (mov->m_type == MOVType::REG)
+      return getAddressBase(mov->m_src, def_map, depth + 1);
+  }
+  return "";
+}
+
+std::string getAddressBase(
+    InstPtr inst, std::unordered_map<OpPtr, std::vector<InstPtr>>& def_map) {
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst))
+    return getAddressBase(ldr->m_src, def_map);
+  auto str = std::dynamic_pointer_cast<STRInst>(inst);
+  return getAddressBase(str->m_dest, def_map);
+}
+
+// iterative modulo scheduling at initiation interval ii, with at most two
+// stages and the compare in the first one
+bool moduloSchedule(int ii, int cmp,
+                    std::vector<std::vector<PipelineEdge>>& preds,
+                    std::vector<std::vector<PipelineEdge>>& succs,
+                    std::vector<int>& height, std::vector<int>& time) {
+  int n = preds.size();
+  std::vector<int> last_time(n, -1);
+  std::vector<int> mrt(ii, -1);  // one instruction issued per cycle
+  time.assign(n, -1);
+  auto unschedule = [&](int i) {
+    mrt[time[i] % ii] = -1;
+    time[i] = -1;
+  };
+  for (int budget = n * PIPELINE_BUDGET; budget > 0; budget--) {
+    int op = -1;
+    for (int i = 0; i < n; i++) {
+      if (time[i] == -1 && (op == -1 || height[i] > height[op])) op = i;
+    }
+    if (op == -1) return true;
+
+    int max_time = op == cmp ? ii - 1 : 2 * ii - 1;
+    int estart = 0;
+    for (auto& e : preds[op]) {
+      if (time[e.node] >= 0)
+        estart = std::max(estart, time[e.node] + e.latency - e.distance * ii);
+    }
+    if (estart > max_time) return false;
+    int t = -1;
+    for (int tt = estart; tt <= std::min(estart + ii - 1, max_time); tt++) {
+      if (mrt[tt % ii] == -1) {
+        t = tt;
+        break;
+      }
+    }
+    if (t == -1) {
+      // evict the instruction in the slot, never retry the same time
+      t = estart;
+      if (last_time[op] >= estart && last_time[op] < max_time)
+        t = last_time[op] + 1;
+      if (mrt[t % ii] != -1) unschedule(mrt[t % ii]);
+    }
+    for (auto& e : succs[op]) {
+      if (e.node != op && time[e.node] >= 0
+          && time[e.node] + e.distance * ii < t + e.latency)
+        unschedule(e.node);
+    }
+    time[op] = last_time[op] = t;
+    mrt[t % ii] = op;
+  }
+  return false;
+}
+
+bool pipelineLoop(std::shared_ptr<ASM_Function> func,
+                  std::shared_ptr<ASM_BasicBlock> body) {
+  auto fallThrough = [&](std::shared_ptr<ASM_BasicBlock> block) {
+    auto iter = std::find(func->m_blocks.begin(), func->m_blocks.end(), block);
+    iter++;
+    return iter == func->m_blocks.end() ? nullptr : *iter;
+  };
+
+  // body: ...; B head
+  if (body == func->m_blocks.front() || body == func->m_rblock) return false;
+  if (body->m_branch_pos == body->m_insts.end()
+      || std::next(body->m_branch_pos) != body->m_insts.end())
+    return false;
+  auto back = std::dynamic_pointer_cast<BInst>(*body->m_branch_pos);
+  if (!back || back->m_cond != CondType::NONE) return false;
+  auto head = back->m_target;
+  if (head == body || head == func->m_blocks.front()) return false;
+  if (body->m_predecessors.size() != 1 || body->m_predecessors[0] != head
+      || head->m_predecessors.size() != 2)
+    return false;
+
+  // head: ...; Bcc exit (or body); [B body (or exit)]
+  if (head->m_branch_pos == head->m_insts.end()) return false;
+  auto br = std::dynamic_pointer_cast<BInst>(*head->m_branch_pos);
+  if (!br || br->m_cond == CondType::NONE) return false;
+  std::shared_ptr<ASM_BasicBlock> other;
+  auto next = std::next(head->m_branch_pos);
+  if (next == head->m_insts.end()) {
+    other = fallThrough(head);
+  } else {
+    auto b = std::dynamic_pointer_cast<BInst>(*next);
+    if (!b || b->m_cond != CondType::NONE
+        || std::next(next) != head->m_insts.end())
+      return false;
+    other = b->m_target;
+  }
+  std::shared_ptr<ASM_BasicBlock> exit;
+  CondType cont_cond;
+  if (br->m_target == body) {
+    exit = other;
+    cont_cond = br->m_cond;
+  } else if (other == body) {
+    exit = br->m_target;
+    cont_cond = getOppositeCond(br->m_cond);
+  } else {
+    return false;
+  }
+  if (!exit || exit == head || exit == body) return false;
+
+  // one iteration: the body, then a copy of the head
+  std::vector<InstPtr> insts;
+  for (auto iter = body->m_insts.begin(); iter != body->m_branch_pos; iter++) {
+    if (!(*iter)->m_is_deleted) insts.push_back(*iter);
+  }
+  int head_begin = insts.size();
+  for (auto iter = head->m_insts.begin(); iter != head->m_branch_pos; iter++) {
+    if ((*iter)->m_is_deleted) continue;
+    auto clone = cloneInstruction(*iter);
+    if (!clone) return false;
+    insts.push_back(clone);
+  }
+  int n = insts.size();
+  if (n > PIPELINE_MAX_INSTS) return false;
+
+  int cmp = -1;
+  std::unordered_map<OpPtr, int> def_pos;
+  for (int i = 0; i < n; i++) {
+    auto& inst = insts[i];
+    if (inst->m_cond != CondType::NONE || inst->m_set_flag
+        || inst->m_params_offset != 0 || !cloneInstruction(inst))
+      return false;
+    if (isCompare(inst)) {
+      if (cmp != -1 || i < head_begin) return false;
+      cmp = i;
+    }
+    for (auto& set : {inst->m_def, inst->m_f_def}) {
+      for (auto& d : set) {
+        // every register is defined once per iteration
+        if (d->m_op_type != OperandType::VREG || def_pos.count(d))
+          return false;
+        def_pos[d] = i;
+      }
+    }
+    for (auto& set : {inst->m_use, inst->m_f_use}) {
+      for (auto& u : set) {
+        if (u->m_op_type == OperandType::REG && u->m_rreg != RReg::SP)
+          return false;
+      }
+    }
+  }
+  if (cmp == -1) return false;
+
+  // dependences, edges of distance 0 always go forward
+  std::vector<std::vector<PipelineEdge>> preds(n), succs(n);
+  auto addEdge = [&](int from, int to, int latency, int distance) {
+    preds[to].push_back({from, latency, distance});
+    succs[from].push_back({to, latency, distance});
+  };
+  for (int i = 0; i < n; i++) {
+    for (auto& set : {insts[i]->m_use, insts[i]->m_f_use}) {
+      for (auto& u : set) {
+        if (!def_pos.count(u)) continue;
+        int d = def_pos[u];
+        if (i > d) {
+          addEdge(d, i, getLatency(insts[d]), 0);
+        } else {
+          // value of the previous iteration
+          addEdge(d, i, getLatency(insts[d]), 1);
+          if (i < d) addEdge(i, d, 0, 0);
+        }
+      }
+    }
+  }
+  std::unordered_map<OpPtr, std::vector<InstPtr>> def_map;
+  for (auto& block : func->m_blocks) {
+    for (auto& inst : block->m_insts) {
+      if (inst->m_is_deleted) continue;
+      for (auto& set : {inst->m_def, inst->m_f_def}) {
+        for (auto& d : set) def_map[d].push_back(inst);
+      }
+    }
+  }
+  std::vector<int> mem;
+  std::vector<std::string> base(n);
+  for (int i = 0; i < n; i++) {
+    if (!isMemoryAccess(insts[i])) continue;
+    base[i] = getAddressBase(insts[i], def_map);
+    bool is_store = insts[i]->m_op == InstOp::STR
+                    || insts[i]->m_op == InstOp::VSTR;
+    for (auto j : mem) {
+      bool store_j = insts[j]->m_op == InstOp::STR
+                     || insts[j]->m_op == InstOp::VSTR;
+      if (!is_store && !store_j) continue;
+      if (!base[i].empty() && !base[j].empty() && base[i] != base[j])
+        continue;
+      addEdge(j, i, store_j && !is_store ? 1 : 0, 0);
+      addEdge(i, j, is_store && !store_j ? 1 : 0, 1);
+    }
+    mem.push_back(i);
+  }
+
+  // the length of the loop when it is list scheduled, and the longest
+  // acyclic paths bounding the initiation interval of each recurrence
+  std::vector<int> height(n, 0), asap(n, 0);
+  std::vector<std::vector<int>> longest(n, std::vector<int>(n, -1));
+  int length = n;
+  for (int i = n - 1; i >= 0; i--) {
+    height[i] = getLatency(insts[i]);
+    longest[i][i] = 0;
+    for (auto& e : succs[i]) {
+      if (e.distance) continue;
+      height[i] = std::max(height[i], e.latency + height[e.node]);
+      for (int k = 0; k < n; k++) {
+        if (longest[e.node][k] >= 0)
+          longest[i][k]
+              = std::max(longest[i][k], e.latency + longest[e.node][k]);
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    for (auto& e : preds[i]) {
+      if (!e.distance) asap[i] = std::max(asap[i], asap[e.node] + e.latency);
+    }
+    length = std::max(length, asap[i] + 1);
+  }
+  int min_ii = n;
+  for (int i = 0; i < n; i++) {
+    for (auto& e : succs[i]) {
+      if (e.distance && longest[e.node][i] >= 0)
+        min_ii = std::max(min_ii, longest[e.node][i] + e.latency);
+    }
+  }
+
+  int ii = min_ii;
+  std::vector<int> time;
+  while (ii < length && !moduloSchedule(ii, cmp, preds, succs, height, time))
+    ii++;
+  if (ii >= length) return false;
+  if (*std::max_element(time.begin(), time.end()) < ii) return false;
+
+  // register pressure of the kernel
+  std::unordered_set<OpPtr> live_out;
+  for (auto reg_type : {RegType::R, RegType::S}) {
+    func->LivenessAnalysis(reg_type);
+    live_out.insert(exit->m_livein.begin(), exit->m_livein.end());
+  }
+  std::vector<int> occupied_r(ii, 0), occupied_s(ii, 0);
+  int invariant_r = 0, invariant_s = 0;
+  std::unordered_set<OpPtr> invariants;
+  for (int i = 0; i < n; i++) {
+    for (auto& set : {insts[i]->m_use, insts[i]->m_f_use}) {
+      for (auto& u : set) {
+        if (u->m_op_type != OperandType::VREG || def_pos.count(u)
+            || !invariants.insert(u).second)
+          continue;
+        (u->m_is_float ? invariant_s : invariant_r)++;
+      }
+    }
+  }
+  std::unordered_map<OpPtr, int> live_end;
+  for (int i = 0; i < n; i++) {
+    for (auto& set : {insts[i]->m_use, insts[i]->m_f_use}) {
+      for (auto& u : set) {
+        if (!def_pos.count(u)) continue;
+        int t = time[i] + (i > def_pos[u] ? 0 : ii);
+        live_end[u] = std::max(live_end[u], t);
+      }
+    }
+  }
+  for (auto& [d, i] : def_pos) {
+    int end = std::max(live_end[d], time[i] + 1);
+    if (live_out.count(d)) end = std::max(end, time[i] + ii);
+    auto& occupied = d->m_is_float ? occupied_s : occupied_r;
+    for (int t = time[i]; t < end; t++) occupied[t % ii]++;
+  }
+  if (invariant_r + *std::max_element(occupied_r.begin(), occupied_r.end())
+          > SCHEDULE_PRESSURE_R
+      || invariant_s + *std::max_element(occupied_s.begin(), occupied_s.end())
+             > SCHEDULE_PRESSURE_S)
+    return false;
+
+  // values of stage 0 read in stage 1 are renamed, the kernel has already
+  // defined the ones of the next iteration
+  std::unordered_map<OpPtr, OpPtr> rotated;
+  for (int i = 0; i < n; i++) {
+    if (time[i] < ii) continue;
+    for (auto& set : {insts[i]->m_use, insts[i]->m_f_use}) {
+      for (auto& u : set) {
+        if (!def_pos.count(u) || time[def_pos[u]] >= ii) continue;
+        if (!rotated.count(u))
+          rotated[u] = std::make_shared<Operand>(OperandType::VREG,
+                                                 u->m_is_float);
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (time[i] < ii) continue;
+    std::vector<OpPtr> uses;
+    for (auto& set : {insts[i]->m_use, insts[i]->m_f_use}) {
+      for (auto& u : set) {
+        if (rotated.count(u)) uses.push_back(u);
+      }
+    }
+    for (auto& u : uses) insts[i]->replaceUse(rotated[u], u);
+  }
+
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [&](int a, int b) { return time[a] < time[b]; });
+  int depth = body->m_loop_depth;
+  auto prologue = std::make_shared<ASM_BasicBlock>(std::max(depth - 1, 0));
+  auto kernel = std::make_shared<ASM_BasicBlock>(depth);
+  auto epilogue = std::make_shared<ASM_BasicBlock>(std::max(depth - 1, 0));
+  // the head runs once more than the body each time the loop is entered
+  if (head->m_frequency >= 0 && body->m_frequency >= 0) {
+    kernel->m_frequency = body->m_frequency;
+    prologue->m_frequency
+        = std::max(head->m_frequency - body->m_frequency, 0.0);
+    epilogue->m_frequency = prologue->m_frequency;
+  }
+  auto appendRotation = [&](std::shared_ptr<ASM_BasicBlock> block) {
+    for (auto& [v, v_old] : rotated) {
+      block->insert(std::make_shared<MOVInst>(v_old, v));
+    }
+  };
+  auto appendBranch = [&](std::shared_ptr<ASM_BasicBlock> block,
+                          std::shared_ptr<ASM_BasicBlock> target,
+                          CondType cond) {
+    auto b = std::make_shared<BInst>(target);
+    b->m_cond = cond;
+    block->insert(b);
+    block->appendSuccessor(target);
+    target->appendPredecessor(block);
+  };
+
+  for (auto i : order) {
+    if (time[i] < ii) prologue->insert(cloneInstruction(insts[i]));
+  }
+  appendRotation(prologue);
+  appendBranch(prologue, epilogue, getOppositeCond(cont_cond));
+  prologue->m_branch_pos = std::prev(prologue->m_insts.end());
+  prologue->appendSuccessor(kernel);
+  kernel->appendPredecessor(prologue);
+
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return time[a] % ii < time[b] % ii; });
+  for (auto i : order) kernel->insert(insts[i]);
+  appendRotation(kernel);
+  appendBranch(kernel, kernel, cont_cond);
+  kernel->m_branch_pos = std::prev(kernel->m_insts.end());
+  kernel->appendSuccessor(epilogue);
+  epilogue->appendPredecessor(kernel);
+
+  std::sort(order.begin(), order.end(),
+            [&](int a, int b) { return time[a] < time[b]; });
+  for (auto i : order) {
+    if (time[i] >= ii) epilogue->insert(cloneInstruction(insts[i]));
+  }
+  appendBranch(epilogue, exit, CondType::NONE);
+  epilogue->m_branch_pos = std::prev(epilogue->m_insts.end());
+
+  // head: Bcc exit; B prologue
+  auto pos = std::find(func->m_blocks.begin(), func->m_blocks.end(), body);
+  pos = func->m_blocks.erase(pos);
+  func->m_blocks.insert(pos, {prologue, kernel, epilogue});
+  if (fallThrough(epilogue) == exit) {
+    epilogue->m_insts.pop_back();
+    epilogue->m_branch_pos = epilogue->m_insts.end();
+  }
+  head->m_insts.erase(head->m_branch_pos, head->m_insts.end());
+  head->removeSuccessor(body);
+  head->removePredecessor(body);
+  head->removeSuccessor(exit);
+  exit->removePredecessor(head);
+  appendBranch(head, exit, getOppositeCond(cont_cond));
+  head->m_branch_pos = std::prev(head->m_insts.end());
+  appendBranch(head, prologue, CondType::NONE);
+  if (fallThrough(head) == prologue) head->m_insts.pop_back();
+
+  std::cerr << "[debug] pipeline " << body->m_label << ": ii " << ii
+            << ", length " << length << std::endl;
+  return true;
+}
+
+void pipelineLoops(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) {
+    std::vector<std::shared_ptr<ASM_BasicBlock>> blocks(func->m_blocks.begin(),
+                                                        func->m_blocks.end());
+    for (auto& block : blocks) pipelineLoop(func, block);
+  }
+}
@@ -5,9 +5,10 @@
 // #define REG_ALLOC_DEBUG
 
 RegisterAllocator::RegisterAllocator(std::shared_ptr<ASM_Module> module,
-                                     RegType type) {
+                                     RegType type, bool linear_scan) {
   m_module = module;
   m_reg_type = type;
+  m_linear_scan = linear_scan;
 }
 
 void RegisterAllocator::Allocate() {
@@ -17,7 +18,10 @@ void RegisterAllocator::Allocate() {
     setCurFunction(func);
     init();
     getInitial();
-    AllocateCurFunc();
+    if (m_linear_scan || initial.size() > LINEAR_SCAN_THRESHOLD)
+      LinearScanCurFunc();
+    else
+      AllocateCurFunc();
     if (m_reg_type == RegType::R) {
       for (auto& node : coloredNodes) {
         RReg rreg = color_r[node];
@@ -75,6 +79,8 @@ void RegisterAllocator::init() {
   color_r.clear();
   color_s.clear();
   isSelectSpill = false;
+  m_spill_temps.clear();
+  m_split_slot.clear();
 }
 
 void RegisterAllocator::initialColors() {
@@ -122,12 +128,128 @@ void RegisterAllocator::getInitial() {
   // std::cout << std::endl;
 }
 
-void RegisterAllocator::updateDepth(std::shared_ptr<ASM_BasicBlock> block,
-                                    OpPtr node) {
-  assert(block);
-  if (m_depth_map[node] < block->m_loop_depth) {
-    m_depth_map[node] = block->m_loop_depth;
+double getBlockWeight(std::shared_ptr<ASM_Function> func,
+                      std::shared_ptr<ASM_BasicBlock> block) {
+  double entry = func->m_blocks.front()->m_frequency;
+  if (entry <= 0)
+    return pow(SPILL_LOOP_WEIGHT, std::min(block->m_loop_depth, 8));
+  if (block->m_frequency >= 0) return block->m_frequency / entry;
+  // made after the profile was read, it runs at most as often as the blocks
+  // around it, as in layoutBlocks
+  auto& preds = block->m_predecessors;
+  auto& succs = block->m_successors;
+  if (preds.empty() || succs.empty()) return 0;
+  double freq = std::min(preds[0]->m_frequency, succs[0]->m_frequency);
+  return std::max(0.0, freq) / entry;
+}
+
+void RegisterAllocator::addSpillCost(std::shared_ptr<ASM_BasicBlock> block,
+                                     OpPtr node) {
+  if (node->m_op_type != OperandType::VREG) return;
+  m_spill_cost[node] += getBlockWeight(m_cur_func, block);
+}
+
+// a load from or store to the spill slot at offs
+bool isSlotAccess(std::shared_ptr<ASM_Instruction> inst, int offs) {
+  if (inst->m_cond != CondType::NONE) return false;
+  OpPtr base, imm;
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+    if (ldr->m_type != LDRInst::Type::REG || ldr->m_shift) return false;
+    base = ldr->m_src;
+    imm = ldr->m_offs;
+  } else if (auto str = std::dynamic_pointer_cast<STRInst>(inst)) {
+    if (str->m_shift) return false;
+    base = str->m_dest;
+    imm = str->m_offs;
+  } else {
+    return false;
+  }
+  return base == Operand::getRReg(RReg::SP)
+         && imm->m_op_type == OperandType::IMM && imm->m_int_val == offs;
+}
+
+// a definition that can be repeated anywhere: an immediate, the address of a
+// global, or the address of a local on the stack
+bool isRematerializable(std::shared_ptr<ASM_Instruction> inst) {
+  if (inst->m_cond != CondType::NONE) return false;
+  if (auto mov = std::dynamic_pointer_cast<MOVInst>(inst)) {
+    return mov->m_type == MOVType::IMM;
+  } else if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+    return ldr->m_type == LDRInst::Type::LABEL;
+  } else if (auto as = std::dynamic_pointer_cast<ASInst>(inst)) {
+    return as->m_op == InstOp::ADD && !as->m_shift
+           && as->m_operand1 == Operand::getRReg(RReg::SP)
+           && as->m_operand2->m_op_type == OperandType::IMM;
+  }
+  return false;
+}
+
+// recompute a spilled value before each of its uses instead of storing it,
+// false if it has to go through the stack
+bool RegisterAllocator::Rematerialize(OpPtr v,
+                                      std::unordered_set<OpPtr>& new_temps) {
+  if (m_remat_def.find(v) == m_remat_def.end() || !m_remat_def[v])
+    return false;
+  auto def = m_remat_def[v];
+  auto getUses = [&](std::shared_ptr<ASM_Instruction> inst) {
+    return m_reg_type == RegType::R ? inst->m_use : inst->m_f_use;
+  };
+
+  // a stack address is relative to sp, which is moved around calls
+  auto as = std::dynamic_pointer_cast<ASInst>(def);
+  auto getFrameOffs = [&](std::shared_ptr<ASM_Instruction> inst) {
+    return as->m_operand2->m_int_val - def->m_params_offset
+           + inst->m_params_offset;
+  };
+  for (auto& b : m_cur_func->m_blocks) {
+    for (auto& i : b->m_insts) {
+      if (i->m_is_deleted || getUses(i).find(v) == getUses(i).end()) continue;
+      if (as && !Operand::immCheck(getFrameOffs(i))) return false;
+    }
   }
+
+  def->m_is_deleted = true;
+  for (auto& b : m_cur_func->m_blocks) {
+    for (auto iter = b->m_insts.begin(); iter != b->m_insts.end(); iter++) {
+      auto i = *iter;
+      if (i->m_is_deleted || getUses(i).find(v) == getUses(i).end()) continue;
+      // a move from v becomes the definition itself
+      OpPtr dest;
+      auto mov = std::dynamic_pointer_cast<MOVInst>(i);
+      if (mov && mov->m_cond == CondType::NONE
+          && mov->m_dest->m_is_float == v->m_is_float) {
+        dest = mov->m_dest;
+        i->m_is_deleted = true;
+      } else {
+        dest = std::make_shared<Operand>(OperandType::VREG, v->m_is_float);
+        i->replaceUse(dest, v);
+      }
+      std::shared_ptr<ASM_Instruction> remat;
+      if (auto mov_def = std::dynamic_pointer_cast<MOVInst>(def)) {
+        if (mov_def->m_src->m_is_float)
+          remat = std::make_shared<MOVInst>(dest, mov_def->m_src->m_float_val);
+        else
+          remat = std::make_shared<MOVInst>(dest, mov_def->m_src->m_int_val);
+      } else if (auto ldr = std::dynamic_pointer_cast<LDRInst>(def)) {
+        remat = std::make_shared<LDRInst>(dest, ldr->m_label);
+      } else {
+        remat = std::make_shared<ASInst>(
+            InstOp::ADD, dest, Operand::getRReg(RReg::SP),
+            std::make_shared<Operand>(getFrameOffs(i)));
+      }
+      remat->m_params_offset = i->m_params_offset;
+      remat->m_block = b;
+      if (m_cur_func->m_spill_slots.find(def)
+          != m_cur_func->m_spill_slots.end())
+        m_cur_func->m_spill_slots[remat] = m_cur_func->m_spill_slots[def];
+      b->m_insts.insert(iter, remat);
+      if (dest->m_op_type == OperandType::VREG) {
+        new_temps.insert(dest);
+        m_spill_temps.insert(dest);
+      }
+    }
+  }
+  return true;
 }
 
 void RegisterAllocator::AllocateCurFunc() {
@@ -181,6 +303,8 @@ void RegisterAllocator::Build() {
   debug("Build");
 #endif
   OpPtr temp;
+  m_spill_cost.clear();
+  m_remat_def.clear();
   for (auto& b : m_cur_func->m_blocks) {
     std::unordered_set<OpPtr> live = b->m_liveout;
     std::unordered_map<OpPtr, int> lifespan_map;
@@ -197,34 +321,43 @@ void RegisterAllocator::Build() {
         defs = inst->m_f_def;
         uses = inst->m_f_use;
       }
+      // a conditional def keeps the old value when not executed
+      if (inst->m_cond != CondType::NONE) uses.insert(defs.begin(), defs.end());
       if (auto I = std::dynamic_pointer_cast<MOVInst>(inst)) {
-        if (I->m_type != MOVType::IMM && I->m_dest->getRegType() == m_reg_type
+        if (I->m_type != MOVType::IMM && I->m_cond == CondType::NONE
+            && I->m_dest->getRegType() == m_reg_type
             && I->m_src->getRegType() == m_reg_type) {
           // for (auto& use : uses) {
           //   live.erase(use);
           // }
           for (auto& n : defs) {
             moveList[n].insert(I);
-            updateDepth(I->m_block, n);
           }
           for (auto& n : uses) {
             if (n->m_op_type == OperandType::IMM) {
               continue;
             }
             moveList[n].insert(I);
-            updateDepth(I->m_block, n);
           }
           worklistMoves.insert(I);
         }
       }
       for (auto& def : defs) {
         live.insert(def);
+        addSpillCost(b, def);
+        if (def->m_op_type != OperandType::VREG) continue;
+        if (m_remat_def.find(def) == m_remat_def.end()
+            && isRematerializable(inst))
+          m_remat_def[def] = inst;
+        else
+          m_remat_def[def] = nullptr;
+      }
+      for (auto& use : uses) {
+        addSpillCost(b, use);
       }
       for (auto& d : defs) {
         for (auto& l : live) {
           AddEdge(l, d);
-          updateDepth(inst->m_block, l);
-          updateDepth(inst->m_block, d);
         }
       }
       // live := use(I) ∪ (live\def(I))
@@ -422,6 +555,7 @@ void RegisterAllocator::Combine(OpPtr u, OpPtr v) {
   }
   coalescedNodes.insert(v);
   alias[v] = u;
+  m_spill_cost[u] += m_spill_cost[v];
   for (auto& n : moveList[v]) {
     moveList[u].insert(n);
   }
@@ -478,20 +612,13 @@ void RegisterAllocator::SelectSpill() {
   //   coalescedRecord.insert(coalescedNodes.begin(), coalescedNodes.end());
   //   isSelectSpill = true;
   // }
-  OpPtr m = *std::max_element(
-      spillWorklist.cbegin(), spillWorklist.cend(), [this](OpPtr a, OpPtr b) {
-        // return a->lifespan < b->lifespan;
-        if (a->lifespan && b->lifespan) {
-          // still compare degree if lifespan is equal!
-          if (a->lifespan != b->lifespan) return a->lifespan < b->lifespan;
-        } else if (a->lifespan)
-          return true;
-        else if (b->lifespan)
-          return false;
-        assert(m_depth_map.find(a) != m_depth_map.cend()
-               && m_depth_map.find(b) != m_depth_map.cend());
-        return degree[a] / pow(2, m_depth_map[a])
-               < degree[b] / pow(2, m_depth_map[b]);
+  // the cheapest node per interference it removes, spill temporaries only if
+  // nothing else is left
+  OpPtr m = *std::min_element(
+      spillWorklist.cbegin(), spillWorklist.cend(), [&](OpPtr a, OpPtr b) {
+        bool temp_a = m_spill_temps.count(a), temp_b = m_spill_temps.count(b);
+        if (temp_a != temp_b) return temp_b;
+        return getSpillCost(a) / degree[a] < getSpillCost(b) / degree[b];
       });
 
   spillWorklist.erase(m);
@@ -499,6 +626,54 @@ void RegisterAllocator::SelectSpill() {
   FreezeMoves(m);
 }
 
+double RegisterAllocator::getSpillCost(OpPtr n) {
+  if (m_remat_def.find(n) != m_remat_def.end() && m_remat_def[n])
+    return m_spill_cost[n] * SPILL_REMAT_WEIGHT;
+  return m_spill_cost[n];
+}
+
+// a temporary of a spilled value that gets no color is not spilled again,
+// which may go on forever, the cheapest neighbors sharing a color are spilled
+// instead. returns the color freed, -1 if there is none
+int RegisterAllocator::EvictNeighbors(OpPtr n) {
+  std::unordered_map<int, std::unordered_set<OpPtr>> holders;
+  std::unordered_set<int> fixed;
+  for (auto& w : adjList[n]) {
+    OpPtr a = GetAlias(w);
+    if (a->getRegType() != m_reg_type) continue;
+    int c;
+    if (a->m_op_type == OperandType::REG) {
+      c = m_reg_type == RegType::R ? (int)a->m_rreg : (int)a->m_sreg;
+    } else if (coloredNodes.find(a) != coloredNodes.end()) {
+      c = m_reg_type == RegType::R ? (int)color_r[a] : (int)color_s[a];
+      if (m_spill_temps.find(a) == m_spill_temps.end()) {
+        holders[c].insert(a);
+        continue;
+      }
+    } else {
+      continue;
+    }
+    fixed.insert(c);
+  }
+  int best = -1;
+  double best_cost = 0;
+  for (auto& [c, nodes] : holders) {
+    if (fixed.find(c) != fixed.end()) continue;
+    double cost = 0;
+    for (auto& a : nodes) cost += getSpillCost(a);
+    if (best == -1 || cost < best_cost) {
+      best = c;
+      best_cost = cost;
+    }
+  }
+  if (best == -1) return -1;
+  for (auto& a : holders[best]) {
+    coloredNodes.erase(a);
+    spilledNodes.insert(a);
+  }
+  return best;
+}
+
 void RegisterAllocator::AssignColors() {
 #ifdef REG_ALLOC_DEBUG
   debug("AssignColors");
@@ -525,7 +700,13 @@ void RegisterAllocator::AssignColorsR() {
         okColors.erase(color_r[GetAlias(w)]);
       }
     }
-    if (okColors.empty()) {
+    int evicted = -1;
+    if (okColors.empty() && m_spill_temps.find(n) != m_spill_temps.end())
+      evicted = EvictNeighbors(n);
+    if (evicted != -1) {
+      coloredNodes.insert(n);
+      color_r[n] = (RReg)evicted;
+    } else if (okColors.empty()) {
       spilledNodes.insert(n);
     } else {
       coloredNodes.insert(n);
@@ -556,7 +737,13 @@ void RegisterAllocator::AssignColorsS() {
         okColors.erase(color_s[GetAlias(w)]);
       }
     }
-    if (okColors.empty()) {
+    int evicted = -1;
+    if (okColors.empty() && m_spill_temps.find(n) != m_spill_temps.end())
+      evicted = EvictNeighbors(n);
+    if (evicted != -1) {
+      coloredNodes.insert(n);
+      color_s[n] = (SReg)evicted;
+    } else if (okColors.empty()) {
       spilledNodes.insert(n);
     } else {
       coloredNodes.insert(n);
@@ -587,6 +774,7 @@ void RegisterAllocator::RewriteProgram() {
       newTemps.insert(v);
       continue;
     }
+    if (Rematerialize(v, newTemps)) continue;
 
     bool is_stack_param;
     int sp_offs;
@@ -596,17 +784,32 @@ void RegisterAllocator::RewriteProgram() {
       sp_offs = m_cur_func->m_stack_params_offs[v];
     } else {
       is_stack_param = false;
-      sp_offs = m_cur_func->getStackSize();
-      m_cur_func->allocateStack(4);
+      auto root = v;
+      while (m_cur_func->m_split_from.find(root)
+             != m_cur_func->m_split_from.end())
+        root = m_cur_func->m_split_from[root];
+      if (m_split_slot.find(root) == m_split_slot.end()) {
+        m_split_slot[root] = m_cur_func->getStackSize();
+        m_cur_func->allocateStack(4);
+      }
+      sp_offs = m_split_slot[root];
     }
 
+    // a temporary of a spilled temporary is not reused, so that spilling it
+    // again always shortens its live range
+    bool can_reuse = m_spill_temps.find(v) == m_spill_temps.end();
     for (auto& b : m_cur_func->m_blocks) {
+      // the temporary holding v since its last store or load in this block
+      OpPtr reuse = nullptr;
+      int pos = 0, last_pos = 0;
       for (auto iter = b->m_insts.begin(); iter != b->m_insts.end(); iter++) {
         auto& i = *iter;
         auto next = std::next(iter);
         if (i->m_is_deleted) {
           continue;
         }
+        pos++;
+        if (i->m_op == InstOp::BL) reuse = nullptr;
         int fixed_offs = sp_offs + i->m_params_offset;
         std::unordered_set<OpPtr> defs, uses;
         if (m_reg_type == RegType::R) {
@@ -617,21 +820,41 @@ void RegisterAllocator::RewriteProgram() {
           uses = i->m_f_use;
         }
 
+        // a conditional def keeps the old value when not executed, so the
+        // same temporary is also reloaded before it
+        bool is_cond = i->m_cond != CondType::NONE;
+        // a move between an integer and a float register is not a copy, its
+        // other operand belongs to the other allocator
+        auto copy = std::dynamic_pointer_cast<MOVInst>(i);
+        bool is_copy = i->m_is_mov && !is_cond
+                       && copy->m_src->m_is_float == copy->m_dest->m_is_float;
+        OpPtr def_op = nullptr;
+        bool is_def = defs.find(v) != defs.end();
+        OpPtr use_op = nullptr;
+        if (can_reuse && reuse && pos - last_pos <= SPILL_REUSE_DISTANCE)
+          use_op = reuse;
+
         // replace def
         if (defs.find(v) != defs.end()) {
           OpPtr newOp;
           auto next = std::next(iter);
-          if (is_stack_param) {
+          if (is_stack_param || isSlotAccess(i, fixed_offs)) {
+            // a reload of the slot of a split sibling, the value is there
             i->m_is_deleted = true;
+            reuse = nullptr;
             continue;
-          } else if (i->m_is_mov) {
-            newOp = std::dynamic_pointer_cast<MOVInst>(i)->m_src;
+          } else if (is_copy) {
+            newOp = copy->m_src;
             i->m_is_deleted = true;
           } else {
             // replace def
             newOp = std::make_shared<Operand>(OperandType::VREG, v->m_is_float);
             i->replaceDef(newOp, v);
+            if (is_cond) def_op = newOp;
+            m_spill_temps.insert(newOp);
           }
+          reuse = i->m_is_deleted ? nullptr : newOp;
+          last_pos = pos;
           // insert a store instruction after defination of newOp
           OpPtr offs;
           std::shared_ptr<MOVInst> mov = nullptr;
@@ -666,12 +889,15 @@ void RegisterAllocator::RewriteProgram() {
                                               std::make_shared<Operand>(0));
             }
             if (m_reg_type == RegType::R) newTemps.insert(offs);
-            updateDepth(b, offs);
+            m_spill_temps.insert(offs);
           }
           str->m_params_offset = i->m_params_offset;
+          str->m_is_spill = true;
           b->insertSpillSTR(iter, str, add, mov);
+          m_cur_func->m_spill_slots[str] = sp_offs;
+          if (add) m_cur_func->m_spill_slots[add] = sp_offs;
+          if (mov) m_cur_func->m_spill_slots[mov] = sp_offs;
           newTemps.insert(newOp);
-          updateDepth(b, newOp);
           if (next != b->m_insts.end()) {
             auto& next_inst = *next;
             if (next_inst->m_use.find(v) != next_inst->m_use.end()
@@ -685,15 +911,32 @@ void RegisterAllocator::RewriteProgram() {
         }
 
         // replace use
-        if (uses.find(v) != uses.end()) {
+        if (uses.find(v) != uses.end() || def_op) {
           OpPtr newOp;
-          if (i->m_is_mov) {
-            newOp = std::dynamic_pointer_cast<MOVInst>(i)->m_dest;
+          if (!def_op && isSlotAccess(i, fixed_offs)) {
+            // a spill of a split sibling to the same slot
+            i->m_is_deleted = true;
+            continue;
+          } else if (def_op) {
+            newOp = def_op;
+            if (uses.find(v) != uses.end()) i->replaceUse(newOp, v);
+          } else if (use_op) {
+            // still in a register
+            i->replaceUse(use_op, v);
+            if (!is_def) last_pos = pos;
+            continue;
+          } else if (is_copy) {
+            newOp = copy->m_dest;
             i->m_is_deleted = true;
           } else {
             // replace use
             newOp = std::make_shared<Operand>(OperandType::VREG, v->m_is_float);
             i->replaceUse(newOp, v);
+            m_spill_temps.insert(newOp);
+            if (!is_def) {
+              reuse = newOp;
+              last_pos = pos;
+            }
           }
           // insert a load instruction before use of newOp
           OpPtr offs;
@@ -734,14 +977,19 @@ void RegisterAllocator::RewriteProgram() {
                                               std::make_shared<Operand>(0));
             }
             if (m_reg_type == RegType::R) newTemps.insert(offs);
-            updateDepth(b, offs);
+            m_spill_temps.insert(offs);
           }
           ldr->m_params_offset = i->m_params_offset;
           b->insertSpillLDR(iter, ldr, add, mov);
-          if (is_stack_param)
+          if (is_stack_param) {
             m_cur_func->m_params_pos_map[ldr] = std::prev(iter);
+          } else {
+            ldr->m_is_spill = true;
+            m_cur_func->m_spill_slots[ldr] = sp_offs;
+            if (add) m_cur_func->m_spill_slots[add] = sp_offs;
+            if (mov) m_cur_func->m_spill_slots[mov] = sp_offs;
+          }
           newTemps.insert(newOp);
-          updateDepth(b, newOp);
         }
       }
     }
@@ -758,6 +1006,206 @@ void RegisterAllocator::RewriteProgram() {
   // std::swap(coloredNodes, coalescedRecord);
 }
 
+// "Linear Scan Register Allocation" by Poletto and Sarkar, with the second
+// chance of binpacking: a value is live over one interval of the instructions
+// in block order, and when no register is free the value with the fewest uses
+// per instruction is spilled. RewriteProgram gives it short temporaries, which
+// keep a reloaded value for its uses nearby, and the scan is repeated
+void RegisterAllocator::LinearScanCurFunc() {
+  int rounds = 1;
+  while (!LinearScan()) {
+    RewriteProgram();
+    rounds++;
+  }
+  std::cerr << "[debug] " << m_cur_func->m_name << ": linear scan x" << rounds
+            << std::endl;
+}
+
+// returns false if some values are spilled
+bool RegisterAllocator::LinearScan() {
+  m_cur_func->LivenessAnalysis(m_reg_type);
+  m_spill_cost.clear();
+  m_remat_def.clear();
+  bool flag = m_reg_type == RegType::R;
+  auto isVReg = [&](OpPtr op) {
+    return op->m_op_type == OperandType::VREG && op->getRegType() == m_reg_type;
+  };
+  auto getColor = [&](OpPtr op) {
+    if (op->m_op_type != OperandType::REG || op->getRegType() != m_reg_type)
+      return -1;
+    if (flag)
+      return rreg_avaliable.count(op->m_rreg) ? (int)op->m_rreg : -1;
+    return sreg_avaliable.count(op->m_sreg) ? (int)op->m_sreg : -1;
+  };
+
+  // instruction i is used at 2i and defines at 2i + 1
+  std::unordered_map<OpPtr, std::pair<int, int>> interval;
+  // the points at which each register is taken by the code itself
+  std::unordered_map<int, std::vector<int>> fixed;
+  std::unordered_map<OpPtr, std::vector<OpPtr>> hints;
+  auto extend = [&](OpPtr v, int p) {
+    auto found = interval.find(v);
+    if (found == interval.end()) {
+      interval[v] = {p, p};
+    } else {
+      found->second.first = std::min(found->second.first, p);
+      found->second.second = std::max(found->second.second, p);
+    }
+  };
+  int pos = 0;
+  for (auto& b : m_cur_func->m_blocks) {
+    std::vector<std::shared_ptr<ASM_Instruction>> insts;
+    for (auto& i : b->m_insts) {
+      if (!i->m_is_deleted) insts.push_back(i);
+    }
+    if (insts.empty()) continue;
+    int first = pos, last = pos + insts.size() - 1;
+    std::unordered_set<int> live;
+    for (auto& v : b->m_livein) {
+      if (isVReg(v)) extend(v, 2 * first);
+    }
+    for (auto& v : b->m_liveout) {
+      if (isVReg(v))
+        extend(v, 2 * last + 1);
+      else if (getColor(v) != -1)
+        live.insert(getColor(v));
+    }
+    for (int k = insts.size() - 1; k >= 0; k--) {
+      auto& inst = insts[k];
+      int p = first + k;
+      std::unordered_set<OpPtr> defs, uses;
+      if (flag) {
+        defs = inst->m_def;
+        uses = inst->m_use;
+      } else {
+        defs = inst->m_f_def;
+        uses = inst->m_f_use;
+      }
+      bool is_cond = inst->m_cond != CondType::NONE;
+      if (is_cond) uses.insert(defs.begin(), defs.end());
+      if (auto mov = std::dynamic_pointer_cast<MOVInst>(inst)) {
+        if (mov->m_type != MOVType::IMM && !is_cond
+            && mov->m_dest->getRegType() == m_reg_type
+            && mov->m_src->getRegType() == m_reg_type) {
+          hints[mov->m_dest].push_back(mov->m_src);
+          hints[mov->m_src].push_back(mov->m_dest);
+        }
+      }
+      for (int r : live) fixed[r].push_back(2 * p + 1);
+      for (auto& def : defs) {
+        addSpillCost(b, def);
+        if (isVReg(def)) {
+          extend(def, 2 * p + 1);
+          if (m_remat_def.find(def) == m_remat_def.end()
+              && isRematerializable(inst))
+            m_remat_def[def] = inst;
+          else
+            m_remat_def[def] = nullptr;
+        } else if (getColor(def) != -1) {
+          fixed[getColor(def)].push_back(2 * p + 1);
+          if (!is_cond) live.erase(getColor(def));
+        }
+      }
+      for (auto& use : uses) {
+        addSpillCost(b, use);
+        if (isVReg(use))
+          extend(use, 2 * p);
+        else if (getColor(use) != -1)
+          live.insert(getColor(use));
+      }
+      for (int r : live) fixed[r].push_back(2 * p);
+    }
+    pos = last + 1;
+  }
+  for (auto& [r, points] : fixed) std::sort(points.begin(), points.end());
+  auto isFixedFree = [&](int r, int start, int end) {
+    auto& points = fixed[r];
+    auto iter = std::lower_bound(points.begin(), points.end(), start);
+    return iter == points.end() || *iter > end;
+  };
+
+  std::vector<OpPtr> order;
+  for (auto& [v, range] : interval) {
+    order.push_back(v);
+    // RewriteProgram keeps a value over at most one instruction in a register
+    v->lifespan = (range.second - range.first + 1) / 2;
+  }
+  std::sort(order.begin(), order.end(), [&](OpPtr a, OpPtr b) {
+    return interval[a] < interval[b];
+  });
+  std::vector<int> colors;
+  if (flag) {
+    for (auto r : rreg_avaliable) colors.push_back((int)r);
+  } else {
+    for (auto s : sreg_avaliable) colors.push_back((int)s);
+  }
+  auto getWeight = [&](OpPtr v) {
+    return getSpillCost(v) / (interval[v].second - interval[v].first + 1);
+  };
+
+  std::unordered_map<OpPtr, int> color;
+  std::unordered_map<int, OpPtr> holder;
+  std::set<std::pair<int, OpPtr>> active;  // ordered by the end
+  std::unordered_set<OpPtr> spilled;
+  for (auto& v : order) {
+    auto [start, end] = interval[v];
+    while (!active.empty() && active.begin()->first < start) {
+      holder.erase(color[active.begin()->second]);
+      active.erase(active.begin());
+    }
+    auto isFree = [&](int c) {
+      return c != -1 && holder.find(c) == holder.end()
+             && isFixedFree(c, start, end);
+    };
+    int c = -1;
+    for (auto& h : hints[v]) {
+      int hint = isVReg(h) ? (color.count(h) ? color[h] : -1) : getColor(h);
+      if (isFree(hint)) {
+        c = hint;
+        break;
+      }
+    }
+    for (int i = 0; c == -1 && i < (int)colors.size(); i++) {
+      if (isFree(colors[i])) c = colors[i];
+    }
+    if (c == -1) {
+      // temporaries of spilled values give up their registers last
+      OpPtr victim = v;
+      auto isCheaper = [&](OpPtr a, OpPtr b) {
+        bool temp_a = m_spill_temps.find(a) != m_spill_temps.end();
+        bool temp_b = m_spill_temps.find(b) != m_spill_temps.end();
+        if (temp_a != temp_b) return temp_b;
+        return getWeight(a) < getWeight(b);
+      };
+      for (auto& [w_end, w] : active) {
+        if (isFixedFree(color[w], start, end) && isCheaper(w, victim))
+          victim = w;
+      }
+      spilled.insert(victim);
+      if (victim == v) continue;
+      c = color[victim];
+      active.erase({interval[victim].second, victim});
+      color.erase(victim);
+    }
+    color[v] = c;
+    holder[c] = v;
+    active.insert({end, v});
+  }
+
+  if (!spilled.empty()) {
+    spilledNodes = spilled;
+    return false;
+  }
+  for (auto& [v, c] : color) {
+    coloredNodes.insert(v);
+    if (flag)
+      color_r[v] = (RReg)c;
+    else
+      color_s[v] = (SReg)c;
+  }
+  return true;
+}
+
 bool RegisterAllocator::AllOK(OpPtr u, OpPtr v) {
   for (auto& t : Adjacent(v)) {
     if (!OK(t, u)) return false;
@@ -0,0 +1,326 @@
+#include "asm/asm-schedule.h"
+
+#include <algorithm>
+
+typedef std::shared_ptr<Operand> OpPtr;
+typedef std::list<std::shared_ptr<ASM_Instruction>>::iterator InstIter;
+
+int getLatency(std::shared_ptr<ASM_Instruction> inst) {
+  auto ldr = std::dynamic_pointer_cast<LDRInst>(inst);
+  if (ldr && ldr->m_type == LDRInst::Type::LABEL) return 2 * ALU_LATENCY;
+  switch (inst->m_op) {
+    case InstOp::LDR:
+    case InstOp::VLDR:
+    case InstOp::LDRD:
+    case InstOp::LDM:
+    case InstOp::VLDM:
+      return LOAD_LATENCY;
+    case InstOp::MUL:
+    case InstOp::MLA:
+    case InstOp::MLS:
+      return MUL_LATENCY;
+    case InstOp::SMMUL:
+    case InstOp::SMMLA:
+    case InstOp::SMMLS:
+      return SMMUL_LATENCY;
+    case InstOp::SDIV:
+      return SDIV_LATENCY;
+    case InstOp::VMOV:
+    case InstOp::VNEG:
+      return VMOV_LATENCY;
+    case InstOp::VADD:
+    case InstOp::VSUB:
+    case InstOp::VMUL:
+    case InstOp::VCVT:
+    case InstOp::VCMP:
+      return VFP_LATENCY;
+    case InstOp::VMLA:
+    case InstOp::VMLS:
+      return VMLA_LATENCY;
+    case InstOp::VDIV:
+      return VDIV_LATENCY;
+    default:
+      break;
+  }
+  if (auto as = std::dynamic_pointer_cast<ASInst>(inst)) {
+    if (as->m_shift) return ALU_SHIFT_LATENCY;
+  } else if (auto bit = std::dynamic_pointer_cast<BITInst>(inst)) {
+    if (bit->m_shift) return ALU_SHIFT_LATENCY;
+  } else if (auto ct = std::dynamic_pointer_cast<CTInst>(inst)) {
+    if (ct->m_shift) return ALU_SHIFT_LATENCY;
+  }
+  return ALU_LATENCY;
+}
+
+// instructions never moved, regions between them are scheduled separately
+bool isScheduleBarrier(std::shared_ptr<ASM_Instruction> inst) {
+  switch (inst->m_op) {
+    case InstOp::B:
+    case InstOp::BL:
+    case InstOp::PUSH:
+    case InstOp::POP:
+    case InstOp::VPUSH:
+    case InstOp::VPOP:
+      return true;
+    default:
+      break;
+  }
+  // the offsets of spilled values and call arguments depend on sp
+  return inst->m_def.find(Operand::getRReg(RReg::SP)) != inst->m_def.end();
+}
+
+// registers are renamed in place by the allocator, so physical registers are
+// looked up by their number
+OpPtr getRegKey(OpPtr op) {
+  if (op->m_op_type != OperandType::REG) return op;
+  if (op->getRegType() == RegType::R) return Operand::getRReg(op->m_rreg);
+  return Operand::getSReg(op->m_sreg);
+}
+
+// list scheduling of region (ending before pos), live is the set of values
+// live after the region and becomes the set live before it
+void scheduleRegion(std::shared_ptr<ASM_BasicBlock> block,
+                    std::vector<InstIter>& region, InstIter pos,
+                    std::unordered_set<OpPtr>& live, bool post_ra) {
+  int n = region.size();
+
+  // the flags are treated as one more register
+  static OpPtr flags = std::make_shared<Operand>(OperandType::VREG);
+
+  std::vector<std::vector<OpPtr>> defs(n), uses(n);
+  for (int i = 0; i < n; i++) {
+    auto& inst = *region[i];
+    for (auto& set : {inst->m_def, inst->m_f_def}) {
+      for (auto& d : set) defs[i].push_back(getRegKey(d));
+    }
+    for (auto& set : {inst->m_use, inst->m_f_use}) {
+      for (auto& u : set) uses[i].push_back(getRegKey(u));
+    }
+    // a conditional def keeps the old value when not executed
+    if (inst->m_cond != CondType::NONE) {
+      uses[i].insert(uses[i].end(), defs[i].begin(), defs[i].end());
+      uses[i].push_back(flags);
+    }
+    if (inst->m_set_flag || inst->m_op == InstOp::CMP
+        || inst->m_op == InstOp::TST || inst->m_op == InstOp::VCMP)
+      defs[i].push_back(flags);
+  }
+
+  // dependency dag, edges (succ, latency)
+  std::vector<std::vector<std::pair<int, int>>> succs(n);
+  std::vector<int> pred_cnt(n, 0);
+  auto addEdge = [&](int from, int to, int latency) {
+    if (from == to) return;
+    succs[from].emplace_back(to, latency);
+    pred_cnt[to]++;
+  };
+  std::unordered_map<OpPtr, int> last_def;
+  std::unordered_map<OpPtr, std::vector<int>> last_uses;
+  int last_store = -1;
+  std::vector<int> loads;
+  for (int i = 0; i < n; i++) {
+    auto& inst = *region[i];
+    for (auto& u : uses[i]) {
+      if (last_def.find(u) != last_def.end())
+        addEdge(last_def[u], i, getLatency(*region[last_def[u]]));
+      last_uses[u].push_back(i);
+    }
+    for (auto& d : defs[i]) {
+      for (auto j : last_uses[d]) addEdge(j, i, 0);
+      if (last_def.find(d) != last_def.end()) addEdge(last_def[d], i, 1);
+      last_uses[d].clear();
+      last_def[d] = i;
+    }
+
+    // memory: loads may pass each other, but not a store
+    bool is_load = inst->m_op == InstOp::VLDR || inst->m_op == InstOp::LDRD
+                   || inst->m_op == InstOp::LDM || inst->m_op == InstOp::VLDM
+                   || (inst->m_op == InstOp::LDR
+                       && std::dynamic_pointer_cast<LDRInst>(inst)->m_type
+                              == LDRInst::Type::REG);
+    bool is_store = inst->m_op == InstOp::STR || inst->m_op == InstOp::VSTR
+                    || inst->m_op == InstOp::STRD || inst->m_op == InstOp::STM
+                    || inst->m_op == InstOp::VSTM;
+    if (is_load) {
+      if (last_store != -1) addEdge(last_store, i, 1);
+      loads.push_back(i);
+    } else if (is_store) {
+      if (last_store != -1) addEdge(last_store, i, 0);
+      for (auto j : loads) addEdge(j, i, 0);
+      loads.clear();
+      last_store = i;
+    }
+  }
+
+  // before allocation, a physical register set for no use the allocator sees
+  // (the return value, read after the jump to the return block) stays after
+  // everything before it, a vreg defined in between could get the register
+  if (!post_ra) {
+    for (int i = 0; i < n; i++) {
+      for (auto& d : defs[i]) {
+        if (d->m_op_type != OperandType::REG || live.count(d)) continue;
+        bool used = false;
+        for (int j = i + 1; j < n && !used; j++) {
+          used = std::find(uses[j].begin(), uses[j].end(), d) != uses[j].end();
+        }
+        if (used) continue;
+        for (int j = 0; j < i; j++) addEdge(j, i, 0);
+        break;
+      }
+    }
+  }
+
+  // priority: the longest latency path to the end of the region
+  std::vector<int> height(n, 0);
+  for (int i = n - 1; i >= 0; i--) {
+    height[i] = getLatency(*region[i]);
+    for (auto [s, latency] : succs[i]) {
+      height[i] = std::max(height[i], latency + height[s]);
+    }
+  }
+
+  // register pressure, tracked over the values live before the region
+  std::unordered_set<OpPtr> live_out = live;
+  for (int i = n - 1; i >= 0; i--) {
+    for (auto& d : defs[i]) live.erase(d);
+    for (auto& u : uses[i]) {
+      if (u != flags) live.insert(u);
+    }
+  }
+  if (n <= 1) return;
+  std::unordered_set<OpPtr> cur_live = live;
+  std::unordered_map<OpPtr, int> remaining_uses;
+  for (int i = 0; i < n; i++) {
+    for (auto& u : uses[i]) remaining_uses[u]++;
+  }
+  auto isLiveAfter = [&](OpPtr op) {
+    return op != flags && (remaining_uses[op] > 0 || live_out.count(op));
+  };
+  auto pressureDelta = [&](int i) {
+    int delta = 0;
+    for (auto& d : defs[i]) {
+      if (!cur_live.count(d) && isLiveAfter(d)) delta++;
+    }
+    for (auto& u : uses[i]) {
+      if (remaining_uses[u] == 1 && !live_out.count(u) && cur_live.count(u))
+        delta--;
+    }
+    return delta;
+  };
+  auto livePressure = [&](bool is_float) {
+    int cnt = 0;
+    for (auto& op : cur_live) {
+      if (op->m_is_float == is_float) cnt++;
+    }
+    return cnt;
+  };
+
+  std::vector<int> earliest(n, 0);
+  std::vector<int> ready;
+  for (int i = 0; i < n; i++) {
+    if (pred_cnt[i] == 0) ready.push_back(i);
+  }
+  std::vector<int> order;
+  int cycle = 0;
+  while (!ready.empty()) {
+    bool high_pressure = !post_ra
+                         && (livePressure(false) >= SCHEDULE_PRESSURE_R
+                             || livePressure(true) >= SCHEDULE_PRESSURE_S);
+    int best = -1;
+    for (auto i : ready) {
+      if (best == -1) {
+        best = i;
+        continue;
+      }
+      if (high_pressure) {
+        int di = pressureDelta(i), db = pressureDelta(best);
+        if (di != db) {
+          if (di < db) best = i;
+          continue;
+        }
+      }
+      // prefer instructions that can issue now, then the critical path
+      bool ri = earliest[i] <= cycle, rb = earliest[best] <= cycle;
+      if (ri != rb) {
+        if (ri) best = i;
+      } else if (!ri && earliest[i] != earliest[best]) {
+        if (earliest[i] < earliest[best]) best = i;
+      } else if (height[i] != height[best]) {
+        if (height[i] > height[best]) best = i;
+      } else if (i < best) {
+        best = i;
+      }
+    }
+    ready.erase(std::find(ready.begin(), ready.end(), best));
+    order.push_back(best);
+    cycle = std::max(cycle, earliest[best]) + 1;
+
+    for (auto& u : uses[best]) {
+      if (--remaining_uses[u] == 0 && !live_out.count(u)) cur_live.erase(u);
+    }
+    for (auto& d : defs[best]) {
+      if (isLiveAfter(d)) cur_live.insert(d);
+    }
+    for (auto [s, latency] : succs[best]) {
+      earliest[s] = std::max(earliest[s], cycle - 1 + latency);
+      if (--pred_cnt[s] == 0) ready.push_back(s);
+    }
+  }
+  assert(order.size() == n);
+
+  for (auto i : order) {
+    block->m_insts.splice(pos, block->m_insts, region[i]);
+  }
+}
+
+// regions are scheduled backward, so that the values live after each of
+// them are known
+void scheduleBlock(std::shared_ptr<ASM_BasicBlock> block, bool post_ra) {
+  std::unordered_set<OpPtr> live;
+  if (!post_ra) live = block->m_liveout;
+  std::vector<InstIter> region;
+  auto region_end = block->m_insts.end();
+  for (auto iter = block->m_insts.end(); iter != block->m_insts.begin();) {
+    --iter;
+    auto inst = *iter;
+    if (inst->m_is_deleted) continue;
+    if (!isScheduleBarrier(inst)) {
+      region.push_back(iter);
+      continue;
+    }
+    std::reverse(region.begin(), region.end());
+    scheduleRegion(block, region, region_end, live, post_ra);
+    region.clear();
+    region_end = iter;
+    for (auto& set : {inst->m_def, inst->m_f_def}) {
+      for (auto& d : set) live.erase(getRegKey(d));
+    }
+    for (auto& set : {inst->m_use, inst->m_f_use}) {
+      for (auto& u : set) live.insert(getRegKey(u));
+    }
+  }
+  std::reverse(region.begin(), region.end());
+  scheduleRegion(block, region, region_end, live, post_ra);
+}
+
+void scheduleInstruction(std::shared_ptr<ASM_Module> module, bool post_ra) {
+  for (auto& func : module->m_funcs) {
+    // pressure is only considered before register allocation
+    std::unordered_map<std::shared_ptr<ASM_BasicBlock>,
+                       std::unordered_set<OpPtr>>
+        liveout;
+    if (!post_ra) {
+      for (auto reg_type : {RegType::R, RegType::S}) {
+        func->LivenessAnalysis(reg_type);
+        for (auto& block : func->m_blocks) {
+          liveout[block].insert(block->m_liveout.begin(),
+                                block->m_liveout.end());
+        }
+      }
+    }
+    for (auto& block : func->m_blocks) {
+      if (!post_ra) block->m_liveout = liveout[block];
+      scheduleBlock(block, post_ra);
+    }
+  }
+}
@@ -0,0 +1,249 @@
+//
+// live-range splitting before register allocation
+//
+// a value live through a loop without being used in it gets a new name
+// inside the loop, copied in the preheader and back at the exits. a value
+// live across a call is copied before the call and back after it. the
+// copies are coalesced again when that is safe, otherwise only the short
+// range in the loop or around the call is spilled, the rest of the value
+// stays in a register
+//
+
+#include "asm/asm-split.h"
+
+#include <algorithm>
+
+#include "asm/asm-register.h"
+
+typedef std::shared_ptr<Operand> OpPtr;
+typedef std::shared_ptr<ASM_BasicBlock> BlockPtr;
+
+struct SplitLoop {
+  BlockPtr head;
+  std::unordered_set<BlockPtr> blocks;
+};
+
+// natural loops of the back edges of a depth-first search, the control flow
+// graph of a sysy program is reducible. outer loops come first
+std::vector<SplitLoop> findLoops(std::shared_ptr<ASM_Function> func) {
+  std::unordered_map<BlockPtr, int> state;  // 1: on the stack, 2: finished
+  std::unordered_map<BlockPtr, std::vector<BlockPtr>> latches;
+  std::vector<BlockPtr> heads;
+  std::vector<std::pair<BlockPtr, int>> stack;
+  stack.emplace_back(func->m_blocks.front(), 0);
+  state[func->m_blocks.front()] = 1;
+  while (!stack.empty()) {
+    auto block = stack.back().first;
+    int i = stack.back().second++;
+    if (i == block->m_successors.size()) {
+      state[block] = 2;
+      stack.pop_back();
+      continue;
+    }
+    auto succ = block->m_successors[i];
+    if (state[succ] == 1) {
+      if (latches.find(succ) == latches.end()) heads.push_back(succ);
+      latches[succ].push_back(block);
+    } else if (state[succ] == 0) {
+      state[succ] = 1;
+      stack.emplace_back(succ, 0);
+    }
+  }
+
+  std::vector<SplitLoop> loops;
+  for (auto& head : heads) {
+    SplitLoop loop;
+    loop.head = head;
+    loop.blocks.insert(head);
+    std::vector<BlockPtr> worklist = latches[head];
+    while (!worklist.empty()) {
+      auto block = worklist.back();
+      worklist.pop_back();
+      if (!loop.blocks.insert(block).second) continue;
+      for (auto& pred : block->m_predecessors) worklist.push_back(pred);
+    }
+    loops.push_back(loop);
+  }
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const SplitLoop& a, const SplitLoop& b) {
+                     return a.blocks.size() > b.blocks.size();
+                   });
+  return loops;
+}
+
+std::unordered_set<OpPtr> getDefs(std::shared_ptr<ASM_Instruction> inst,
+                                  RegType reg_type) {
+  return reg_type == RegType::R ? inst->m_def : inst->m_f_def;
+}
+
+std::unordered_set<OpPtr> getUses(std::shared_ptr<ASM_Instruction> inst,
+                                  RegType reg_type) {
+  return reg_type == RegType::R ? inst->m_use : inst->m_f_use;
+}
+
+int countVRegs(const std::unordered_set<OpPtr>& live) {
+  return std::count_if(live.begin(), live.end(), [](const OpPtr& op) {
+    return op->m_op_type == OperandType::VREG;
+  });
+}
+
+// copies on the edge from -> to, at the end of from or the start of to if
+// the edge is the only way out of or into them
+void insertEdgeCopies(std::shared_ptr<ASM_Function> func, BlockPtr from,
+                      BlockPtr to,
+                      std::vector<std::shared_ptr<MOVInst>>& copies) {
+  if (copies.empty()) return;
+  std::unordered_set<BlockPtr> succs(from->m_successors.begin(),
+                                     from->m_successors.end());
+  std::unordered_set<BlockPtr> preds(to->m_predecessors.begin(),
+                                     to->m_predecessors.end());
+  if (succs.size() > 1 && preds.size() > 1) {
+    auto block = func->splitEdge(from, to);
+    block->m_livein = to->m_livein;
+    block->m_liveout = to->m_livein;
+    to = block;
+    preds = {from};
+  }
+  for (auto& mov : copies) {
+    if (preds.size() == 1) {
+      to->m_insts.push_front(mov);
+      mov->m_block = to;
+    } else {
+      from->m_insts.insert(from->m_branch_pos, mov);
+      mov->m_block = from;
+    }
+  }
+}
+
+void splitLiveRanges(std::shared_ptr<ASM_Function> func, RegType reg_type) {
+  int pressure = reg_type == RegType::R ? SPLIT_PRESSURE_R : SPLIT_PRESSURE_S;
+  int call_pressure = reg_type == RegType::R ? SPLIT_CALL_PRESSURE_R
+                                             : SPLIT_CALL_PRESSURE_S;
+  auto getWeight = [&](BlockPtr block) { return getBlockWeight(func, block); };
+  auto isCandidate = [&](OpPtr op) {
+    return op->m_op_type == OperandType::VREG
+           && op->getRegType() == reg_type
+           && func->m_stack_params_offs.find(op)
+                  == func->m_stack_params_offs.end();
+  };
+
+  // the most values live at once, and live across a call, in each block
+  func->LivenessAnalysis(reg_type);
+  std::unordered_map<BlockPtr, int> max_live, max_call_live;
+  std::unordered_map<OpPtr, double> cost;
+  for (auto& block : func->m_blocks) {
+    auto live = block->m_liveout;
+    for (auto iter = block->m_insts.rbegin(); iter != block->m_insts.rend();
+         iter++) {
+      auto& inst = *iter;
+      if (inst->m_is_deleted) continue;
+      if (inst->m_op == InstOp::BL) {
+        max_call_live[block]
+            = std::max(max_call_live[block], countVRegs(live));
+      }
+      auto defs = getDefs(inst, reg_type), uses = getUses(inst, reg_type);
+      if (inst->m_cond != CondType::NONE) uses.insert(defs.begin(), defs.end());
+      for (auto& d : defs) {
+        live.erase(d);
+        cost[d] += getWeight(block);
+      }
+      for (auto& u : uses) {
+        live.insert(u);
+        cost[u] += getWeight(block);
+      }
+      max_live[block] = std::max(max_live[block], countVRegs(live));
+    }
+  }
+
+  // loops, a value live through a loop is split at most once, at the
+  // outermost loop that needs it
+  std::unordered_map<OpPtr, std::vector<std::unordered_set<BlockPtr>*>> split;
+  auto loops = findLoops(func);
+  for (auto& loop : loops) {
+    if (loop.head == func->m_blocks.front()) continue;
+    bool high_pressure = false;
+    std::unordered_set<OpPtr> used;
+    for (auto& block : loop.blocks) {
+      if (max_live[block] > pressure || max_call_live[block] > call_pressure)
+        high_pressure = true;
+      used.insert(block->m_use.begin(), block->m_use.end());
+      used.insert(block->m_def.begin(), block->m_def.end());
+    }
+    if (!high_pressure) continue;
+
+    std::vector<std::pair<OpPtr, OpPtr>> renamed;
+    for (auto& v : loop.head->m_livein) {
+      if (!isCandidate(v) || used.find(v) != used.end()) continue;
+      bool in_outer = false;
+      for (auto outer : split[v]) {
+        if (outer->find(loop.head) != outer->end()) in_outer = true;
+      }
+      if (in_outer) continue;
+      split[v].push_back(&loop.blocks);
+      auto v_loop
+          = std::make_shared<Operand>(OperandType::VREG, v->m_is_float);
+      func->m_split_from[v_loop] = v;
+      renamed.emplace_back(v, v_loop);
+    }
+    if (renamed.empty()) continue;
+
+    for (auto& pred : loop.head->getPredecessors()) {
+      if (loop.blocks.find(pred) != loop.blocks.end()) continue;
+      std::vector<std::shared_ptr<MOVInst>> copies;
+      for (auto& [v, v_loop] : renamed) {
+        copies.push_back(std::make_shared<MOVInst>(v_loop, v));
+      }
+      insertEdgeCopies(func, pred, loop.head, copies);
+    }
+    for (auto& block : loop.blocks) {
+      for (auto& succ : block->getSuccessors()) {
+        if (loop.blocks.find(succ) != loop.blocks.end()) continue;
+        std::vector<std::shared_ptr<MOVInst>> copies;
+        for (auto& [v, v_loop] : renamed) {
+          if (succ->m_livein.find(v) != succ->m_livein.end())
+            copies.push_back(std::make_shared<MOVInst>(v, v_loop));
+        }
+        insertEdgeCopies(func, block, succ, copies);
+      }
+    }
+  }
+
+  // calls, a value live across a call with too many others is split if it
+  // is used more often than the call is executed
+  func->LivenessAnalysis(reg_type);
+  for (auto& block : func->m_blocks) {
+    auto live = block->m_liveout;
+    for (auto iter = block->m_insts.end(); iter != block->m_insts.begin();) {
+      auto inst = *--iter;
+      if (inst->m_is_deleted) continue;
+      auto call = std::dynamic_pointer_cast<CALLInst>(inst);
+      // sp is moved around calls with arguments on the stack
+      if (call && call->m_params <= 4 && call->m_f_params <= 16
+          && countVRegs(live) > call_pressure) {
+        auto after = std::next(iter);
+        for (auto& v : live) {
+          if (!isCandidate(v) || cost[v] <= 2 * getWeight(block)) continue;
+          auto v_call = std::make_shared<Operand>(OperandType::VREG,
+                                                  v->m_is_float);
+          func->m_split_from[v_call] = v;
+          auto save = std::make_shared<MOVInst>(v_call, v);
+          auto restore = std::make_shared<MOVInst>(v, v_call);
+          save->m_block = restore->m_block = block;
+          block->m_insts.insert(iter, save);
+          block->m_insts.insert(after, restore);
+        }
+      }
+      auto defs = getDefs(inst, reg_type), uses = getUses(inst, reg_type);
+      if (inst->m_cond != CondType::NONE) uses.insert(defs.begin(), defs.end());
+      for (auto& d : defs) live.erase(d);
+      for (auto& u : uses) live.insert(u);
+    }
+  }
+}
+
+void splitLiveRanges(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) {
+    splitLiveRanges(func, RegType::S);
+    splitLiveRanges(func, RegType::R);
+  }
+}
@@ -0,0 +1,319 @@
+//
+// stack slot coloring after register allocation
+//
+// spill slots whose values are never live at the same time share storage,
+// the most used ones get the lowest offsets. if every local is addressed by
+// an immediate, the spill slots are also moved below the locals, so that they
+// stay in range of the offset of LDR and VLDR however large the arrays are
+//
+
+#include "asm/asm-stack.h"
+
+#include <algorithm>
+#include <set>
+
+#include "asm/asm-register.h"
+
+typedef std::shared_ptr<Operand> OpPtr;
+typedef std::shared_ptr<ASM_BasicBlock> BlockPtr;
+typedef std::shared_ptr<ASM_Instruction> InstPtr;
+
+// the immediate stack offset of inst, nullptr if the offset is in a register
+OpPtr* getStackOffs(InstPtr inst) {
+  auto sp = Operand::getRReg(RReg::SP);
+  OpPtr* offs = nullptr;
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst)) {
+    if (ldr->m_type == LDRInst::Type::REG && ldr->m_src == sp && !ldr->m_shift)
+      offs = &ldr->m_offs;
+  } else if (auto str = std::dynamic_pointer_cast<STRInst>(inst)) {
+    if (str->m_dest == sp && !str->m_shift) offs = &str->m_offs;
+  } else if (auto mov = std::dynamic_pointer_cast<MOVInst>(inst)) {
+    if (mov->m_type == MOVType::IMM) offs = &mov->m_src;
+  } else if (auto as = std::dynamic_pointer_cast<ASInst>(inst)) {
+    if (as->m_op == InstOp::ADD && as->m_operand1 == sp && !as->m_shift)
+      offs = &as->m_operand2;
+  }
+  if (!offs || (*offs)->m_op_type != OperandType::IMM) return nullptr;
+  return offs;
+}
+
+// whether the stack offset of inst can be changed to offs
+bool stackOffsCheck(InstPtr inst, int offs) {
+  if (!getStackOffs(inst)) return true;
+  if (auto ldr = std::dynamic_pointer_cast<LDRInst>(inst))
+    return Operand::addrOffsCheck(offs, ldr->m_dest->m_is_float);
+  if (auto str = std::dynamic_pointer_cast<STRInst>(inst))
+    return Operand::addrOffsCheck(offs, str->m_src->m_is_float);
+  if (std::dynamic_pointer_cast<ASInst>(inst)) return Operand::immCheck(offs);
+  return true;
+}
+
+bool isSameReg(OpPtr a, OpPtr b) {
+  if (a == b) return true;
+  return a->m_op_type == OperandType::REG && b->m_op_type == OperandType::REG
+         && a->m_is_float == b->m_is_float
+         && (a->m_is_float ? a->m_sreg == b->m_sreg : a->m_rreg == b->m_rreg);
+}
+
+// a spill load or store addressed by a register is turned back into one
+// addressed by sp if the new offset fits, the address computation in front of
+// it is deleted
+bool foldSpillAddress(std::shared_ptr<ASM_Function> func, BlockPtr block,
+                      std::list<InstPtr>::iterator iter, int offs) {
+  auto inst = *iter;
+  auto ldr = std::dynamic_pointer_cast<LDRInst>(inst);
+  auto str = std::dynamic_pointer_cast<STRInst>(inst);
+  if (!ldr && !str) return false;
+  auto sp = Operand::getRReg(RReg::SP);
+  bool is_float = ldr ? ldr->m_dest->m_is_float : str->m_src->m_is_float;
+  OpPtr base = ldr ? ldr->m_src : str->m_dest;
+  OpPtr addr = base == sp ? (ldr ? ldr->m_offs : str->m_offs) : base;
+  if (!Operand::addrOffsCheck(offs, is_float)) return false;
+
+  // MOV addr, #offs or ADD addr, sp, #offs or both in front of the access,
+  // other instructions not touching addr may be in between
+  std::vector<InstPtr> chain;
+  bool complete = false;
+  for (auto prev = iter; !complete && prev != block->m_insts.begin();) {
+    auto p = *--prev;
+    if (p->m_is_deleted) continue;
+    bool touched = false;
+    for (auto& op : p->m_def) touched |= isSameReg(op, addr);
+    for (auto& op : p->m_use) touched |= isSameReg(op, addr);
+    if (!touched) continue;
+    auto found = func->m_spill_slots.find(p);
+    if (found == func->m_spill_slots.end()
+        || found->second != func->m_spill_slots[inst])
+      return false;
+    if (auto mov = std::dynamic_pointer_cast<MOVInst>(p)) {
+      if (!isSameReg(mov->m_dest, addr)) return false;
+      complete = true;
+    } else if (auto as = std::dynamic_pointer_cast<ASInst>(p)) {
+      if (!isSameReg(as->m_dest, addr)) return false;
+      complete = as->m_operand2->m_op_type == OperandType::IMM;
+    } else {
+      return false;
+    }
+    chain.push_back(p);
+  }
+  if (!complete) return false;
+
+  for (auto& p : chain) p->m_is_deleted = true;
+  InstPtr new_inst;
+  if (ldr)
+    new_inst = std::make_shared<LDRInst>(ldr->m_dest, sp,
+                                         std::make_shared<Operand>(offs));
+  else
+    new_inst = std::make_shared<STRInst>(str->m_src, sp,
+                                         std::make_shared<Operand>(offs));
+  new_inst->m_params_offset = inst->m_params_offset;
+  new_inst->m_is_spill = inst->m_is_spill;
+  new_inst->m_block = block;
+  *iter = new_inst;
+  return true;
+}
+
+void colorStackSlots(std::shared_ptr<ASM_Function> func) {
+  auto& spill_slots = func->m_spill_slots;
+  std::set<int> slot_set;
+  for (auto& [inst, slot] : spill_slots) {
+    if (!inst->m_is_deleted) slot_set.insert(slot);
+  }
+  if (slot_set.empty()) return;
+  std::vector<int> slots(slot_set.begin(), slot_set.end());
+  std::unordered_map<int, int> index;
+  for (int i = 0; i < slots.size(); i++) index[slots[i]] = i;
+  int n = slots.size();
+  int spill_base = slots.front();
+
+  // accesses of each slot, and how often they are executed
+  std::vector<std::vector<InstPtr>> accesses(n);
+  std::vector<double> weight(n);
+  std::unordered_map<BlockPtr, std::set<int>> gen, kill, livein, liveout;
+  for (auto& block : func->m_blocks) {
+    for (auto& inst : block->m_insts) {
+      if (inst->m_is_deleted) continue;
+      auto found = spill_slots.find(inst);
+      if (found == spill_slots.end()) continue;
+      int s = index[found->second];
+      accesses[s].push_back(inst);
+      if (std::dynamic_pointer_cast<LDRInst>(inst)) {
+        if (kill[block].find(s) == kill[block].end()) gen[block].insert(s);
+      } else if (std::dynamic_pointer_cast<STRInst>(inst)) {
+        kill[block].insert(s);
+      } else {
+        continue;
+      }
+      weight[s] += getBlockWeight(func, block);
+    }
+  }
+
+  // a slot is live from a store to the loads reading it
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto b = func->m_blocks.rbegin(); b != func->m_blocks.rend(); b++) {
+      auto block = *b;
+      std::set<int> out;
+      for (auto& succ : block->m_successors) {
+        out.insert(livein[succ].begin(), livein[succ].end());
+      }
+      std::set<int> in = gen[block];
+      for (int s : out) {
+        if (kill[block].find(s) == kill[block].end()) in.insert(s);
+      }
+      if (in != livein[block] || out != liveout[block]) {
+        livein[block] = in;
+        liveout[block] = out;
+        changed = true;
+      }
+    }
+  }
+
+  // slots live at a store of another one interfere with it, a slot read
+  // before any store interferes with all of them
+  std::vector<std::set<int>> adj(n);
+  for (auto& block : func->m_blocks) {
+    auto live = liveout[block];
+    for (auto iter = block->m_insts.rbegin(); iter != block->m_insts.rend();
+         iter++) {
+      auto inst = *iter;
+      if (inst->m_is_deleted) continue;
+      auto found = spill_slots.find(inst);
+      if (found == spill_slots.end()) continue;
+      int s = index[found->second];
+      if (std::dynamic_pointer_cast<STRInst>(inst)) {
+        for (int t : live) {
+          if (t == s) continue;
+          adj[s].insert(t);
+          adj[t].insert(s);
+        }
+        live.erase(s);
+      } else if (std::dynamic_pointer_cast<LDRInst>(inst)) {
+        live.insert(s);
+      }
+    }
+  }
+  for (int s : livein[func->m_blocks.front()]) {
+    for (int t = 0; t < n; t++) {
+      if (t == s) continue;
+      adj[s].insert(t);
+      adj[t].insert(s);
+    }
+  }
+
+  // the most used slots are colored first and get the lowest offsets
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return weight[a] > weight[b]; });
+  std::vector<int> color(n);
+  auto assignColors = [&](int base) {
+    int colors = 0;
+    for (int s : order) {
+      int c = 0;
+      for (; c < n; c++) {
+        bool ok = true;
+        for (int t : adj[s]) {
+          if (color[t] == c) ok = false;
+        }
+        for (auto& inst : accesses[s]) {
+          if (!stackOffsCheck(inst, base + c * 4 + inst->m_params_offset))
+            ok = false;
+        }
+        if (ok) break;
+      }
+      if (c == n) return -1;
+      color[s] = c;
+      colors = std::max(colors, c + 1);
+    }
+    return colors;
+  };
+
+  // other accesses of the stack, the locals can be moved up only if all of
+  // them have an immediate offset
+  auto sp = Operand::getRReg(RReg::SP);
+  std::unordered_set<InstPtr> params_set(func->m_params_set_list.begin(),
+                                         func->m_params_set_list.end());
+  std::vector<InstPtr> locals;
+  bool can_move = true;
+  for (auto& block : func->m_blocks) {
+    for (auto& inst : block->m_insts) {
+      if (inst->m_is_deleted || spill_slots.find(inst) != spill_slots.end()
+          || params_set.find(inst) != params_set.end()
+          || inst->m_use.find(sp) == inst->m_use.end()
+          || inst->m_def.find(sp) != inst->m_def.end())
+        continue;
+      auto offs = getStackOffs(inst);
+      if (!offs || std::dynamic_pointer_cast<MOVInst>(inst)) {
+        can_move = false;
+        continue;
+      }
+      int frame_offs = (*offs)->m_int_val - inst->m_params_offset;
+      // arguments of a call below the frame
+      if (frame_offs < 0) continue;
+      if (frame_offs >= spill_base) can_move = false;
+      locals.push_back(inst);
+    }
+  }
+
+  // the locals are moved up by the size of the spill slots, padded until all
+  // their offsets can be encoded
+  for (auto& c : color) c = -1;
+  int colors = can_move ? assignColors(0) : -1;
+  int shift = -1;
+  for (int pad = colors * 4; colors >= 0 && pad <= colors * 4 + STACK_PAD_LIMIT;
+       pad += 4) {
+    bool ok = true;
+    for (auto& inst : locals) {
+      if (!stackOffsCheck(inst, (*getStackOffs(inst))->m_int_val + pad))
+        ok = false;
+    }
+    if (ok) {
+      shift = pad;
+      break;
+    }
+  }
+  bool moved = shift >= 0;
+  if (moved) {
+    for (auto& inst : locals) {
+      auto offs = getStackOffs(inst);
+      *offs = std::make_shared<Operand>((*offs)->m_int_val + shift);
+    }
+  } else {
+    for (auto& c : color) c = -1;
+    colors = assignColors(spill_base);
+    if (colors < 0) return;
+    shift = colors * 4;
+  }
+
+  int base = moved ? 0 : spill_base;
+  int folded = 0;
+  for (auto& block : func->m_blocks) {
+    for (auto iter = block->m_insts.begin(); iter != block->m_insts.end();
+         iter++) {
+      auto inst = *iter;
+      if (inst->m_is_deleted) continue;
+      auto found = spill_slots.find(inst);
+      if (found == spill_slots.end()) continue;
+      int slot = base + color[index[found->second]] * 4;
+      int offs = slot + inst->m_params_offset;
+      found->second = slot;
+      if (auto imm = getStackOffs(inst)) {
+        *imm = std::make_shared<Operand>(offs);
+      } else if (foldSpillAddress(func, block, iter, offs)) {
+        spill_slots.erase(inst);
+        spill_slots[*iter] = slot;
+        folded++;
+      }
+    }
+  }
+  func->m_local_alloc = spill_base + shift;
+  std::cerr << "[debug] " << func->m_name << ": stack slots " << n << " -> "
+            << colors << (moved ? ", below locals" : "") << ", folded x"
+            << folded << std::endl;
+}
+
+void colorStackSlots(std::shared_ptr<ASM_Module> module) {
+  for (auto& func : module->m_funcs) colorStackSlots(func);
+}
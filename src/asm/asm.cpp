@@ -1,5 +1,7 @@
 #include "asm/asm.h"
 
+#include <algorithm>
+
 CondType GetCondFromIR(IROp op) {
   switch (op) {
     case IROp::I_SGE:
@@ -98,6 +100,160 @@ void ASM_Function::appendPop(std::shared_ptr<Operand> reg) {
     m_pop->m_regs.insert(reg);
 }
 
+// a new block on the edge from -> to, ending with B to if needed. it is put
+// where no other block falls through, the return block stays the last one
+std::shared_ptr<ASM_BasicBlock> ASM_Function::splitEdge(
+    std::shared_ptr<ASM_BasicBlock> from, std::shared_ptr<ASM_BasicBlock> to) {
+  auto fallsThrough = [&](std::shared_ptr<ASM_BasicBlock> block) {
+    if (block == m_rblock) return false;
+    for (auto iter = block->m_insts.rbegin(); iter != block->m_insts.rend();
+         iter++) {
+      if ((*iter)->m_is_deleted) continue;
+      auto b = std::dynamic_pointer_cast<BInst>(*iter);
+      return !b || b->m_cond != CondType::NONE;
+    }
+    return true;
+  };
+
+  auto block = std::make_shared<ASM_BasicBlock>(
+      std::min(from->m_loop_depth, to->m_loop_depth));
+  if (from->m_frequency >= 0 && to->m_frequency >= 0)
+    block->m_frequency = std::min(from->m_frequency, to->m_frequency);
+  auto pos = std::find(m_blocks.begin(), m_blocks.end(), from);
+  auto next = std::next(pos);
+  if (!fallsThrough(from) || next == m_blocks.end() || *next != to) {
+    auto isGap = [&](std::shared_ptr<ASM_BasicBlock> b) {
+      return b != m_rblock && !fallsThrough(b);
+    };
+    auto iter = std::find_if(pos, m_blocks.end(), isGap);
+    if (iter == m_blocks.end())
+      iter = std::find_if(m_blocks.begin(), pos, isGap);
+    if (iter == pos && !isGap(from)) {
+      // no gap at all, from jumps to the block it fell through to
+      auto b = std::make_shared<BInst>(*next);
+      from->insert(b);
+      if (from->m_branch_pos == from->m_insts.end())
+        from->m_branch_pos = std::prev(from->m_insts.end());
+    } else {
+      pos = iter;
+    }
+  }
+  pos = m_blocks.insert(std::next(pos), block);
+
+  for (auto& inst : from->m_insts) {
+    auto b = std::dynamic_pointer_cast<BInst>(inst);
+    if (b && b->m_target == to) b->m_target = block;
+  }
+  std::replace(from->m_successors.begin(), from->m_successors.end(), to,
+               block);
+  std::replace(to->m_predecessors.begin(), to->m_predecessors.end(), from,
+               block);
+  block->appendPredecessor(from);
+  block->appendSuccessor(to);
+
+  if (std::next(pos) != m_blocks.end() && *std::next(pos) == to) {
+    block->m_branch_pos = block->m_insts.end();
+  } else {
+    block->insert(std::make_shared<BInst>(to));
+    block->m_branch_pos = std::prev(block->m_insts.end());
+  }
+  // from jumps to the block right after it
+  if (pos != m_blocks.begin() && *std::prev(pos) == from
+      && !from->m_insts.empty()) {
+    auto b = std::dynamic_pointer_cast<BInst>(from->m_insts.back());
+    if (b && b->m_cond == CondType::NONE && b->m_target == block) {
+      if (from->m_branch_pos == std::prev(from->m_insts.end()))
+        from->m_branch_pos = from->m_insts.end();
+      from->m_insts.pop_back();
+    }
+  }
+  return block;
+}
+
+// moves doing the copies (dest, src) in parallel, by "Revisiting Out-of-SSA
+// Translation for Correctness, Code Quality, and Efficiency": a copy is done
+// once its dest is no longer read, a cycle is broken by a temporary
+static std::vector<std::shared_ptr<MOVInst>> sequentializeCopies(
+    const std::vector<std::pair<std::shared_ptr<Operand>,
+                                std::shared_ptr<Operand>>>& copies) {
+  std::vector<std::shared_ptr<MOVInst>> movs, imm_movs;
+  // where the old value of a source is now, and the source of a dest
+  std::unordered_map<std::shared_ptr<Operand>, std::shared_ptr<Operand>> loc,
+      pred;
+  std::vector<std::shared_ptr<Operand>> ready, todo;
+  for (auto& [dest, src] : copies) {
+    if (src->m_op_type == OperandType::IMM) {
+      imm_movs.push_back(std::make_shared<MOVInst>(dest, src));
+    } else if (dest != src) {
+      loc[src] = src;
+      pred[dest] = src;
+      todo.push_back(dest);
+    }
+  }
+  for (auto& dest : todo) {
+    if (loc.find(dest) == loc.end()) ready.push_back(dest);
+  }
+  while (!todo.empty()) {
+    while (!ready.empty()) {
+      auto b = ready.back();
+      ready.pop_back();
+      auto a = pred[b];
+      auto c = loc[a];
+      movs.push_back(std::make_shared<MOVInst>(b, c));
+      loc[a] = b;
+      if (a == c && pred.find(a) != pred.end()) ready.push_back(a);
+    }
+    auto b = todo.back();
+    todo.pop_back();
+    auto found = loc.find(b);
+    if (found != loc.end() && found->second == b) {
+      auto tmp = std::make_shared<Operand>(OperandType::VREG, b->m_is_float);
+      movs.push_back(std::make_shared<MOVInst>(tmp, b));
+      loc[b] = tmp;
+      ready.push_back(b);
+    }
+  }
+  // immediates read no register, so they go last
+  movs.insert(movs.end(), imm_movs.begin(), imm_movs.end());
+  return movs;
+}
+
+// the copies of an edge go where only that edge runs them: the end of its
+// source, the start of its target, or a new block if the edge is critical
+void ASM_Function::lowerPhiCopies() {
+  std::vector<std::shared_ptr<ASM_BasicBlock>> blocks(m_blocks.begin(),
+                                                      m_blocks.end());
+  for (auto& from : blocks) {
+    auto succs = from->m_successors;
+    std::unordered_set<std::shared_ptr<ASM_BasicBlock>> succ_set(
+        succs.begin(), succs.end()),
+        done;
+    for (auto& to : succs) {
+      if (!done.insert(to).second) continue;
+      auto found = from->m_phi_copies.find(to);
+      if (found == from->m_phi_copies.end()) continue;
+      auto block = from;
+      auto pos = from->m_branch_pos;
+      if (succ_set.size() > 1) {
+        std::unordered_set<std::shared_ptr<ASM_BasicBlock>> preds(
+            to->m_predecessors.begin(), to->m_predecessors.end());
+        if (preds.size() > 1) {
+          block = splitEdge(from, to);
+          pos = block->m_branch_pos;
+        } else {
+          block = to;
+          pos = to->m_insts.begin();
+        }
+      }
+      for (auto& mov : sequentializeCopies(found->second)) {
+        block->m_insts.insert(pos, mov);
+        mov->m_block = block;
+      }
+    }
+    from->m_phi_copies.clear();
+  }
+}
+
 void ASM_BasicBlock::insert(std::shared_ptr<ASM_Instruction> inst) {
   m_insts.push_back(inst);
   inst->m_block = shared_from_this();
@@ -142,14 +298,10 @@ void ASM_BasicBlock::insertPhiMOV(std::shared_ptr<ASM_Instruction> mov) {
   mov->m_block = shared_from_this();
 }
 
-void ASM_BasicBlock::appendFilledMOV(std::shared_ptr<ASM_Instruction> mov) {
-  m_mov_filled_list.push_back(mov);
-}
-
-void ASM_BasicBlock::fillMOV() {
-  for (auto& mov : m_mov_filled_list) {
-    insertPhiMOV(mov);
-  }
+void ASM_BasicBlock::appendPhiCopy(std::shared_ptr<ASM_BasicBlock> succ,
+                                   std::shared_ptr<Operand> dest,
+                                   std::shared_ptr<Operand> src) {
+  m_phi_copies[succ].emplace_back(dest, src);
 }
 
 void ASM_BasicBlock::appendSuccessor(std::shared_ptr<ASM_BasicBlock> succ) {
@@ -234,6 +386,7 @@ bool Operand::immCheck(float imm) {
       return std::ceil(imm) == std::floor(imm);
     }
     imm *= 2;
+    i++;
   }
   return false;
 }
@@ -383,6 +536,14 @@ std::string ASM_Instruction::getOpName() {
       return "LDR";
     case InstOp::STR:
       return "STR";
+    case InstOp::LDRD:
+      return "LDRD";
+    case InstOp::STRD:
+      return "STRD";
+    case InstOp::LDM:
+      return "LDM";
+    case InstOp::STM:
+      return "STM";
     case InstOp::ADR:
       return "ADR";
     case InstOp::MOV:
@@ -465,6 +626,10 @@ std::string ASM_Instruction::getOpName() {
       return "VPUSH";
     case InstOp::VPOP:
       return "VPOP";
+    case InstOp::VLDM:
+      return "VLDM";
+    case InstOp::VSTM:
+      return "VSTM";
     case InstOp::VCVT:
       return "VCVT";
   }
@@ -628,18 +793,39 @@ PInst::PInst(InstOp op) {
     assert(false);
 }
 
+LSMInst::LSMInst(InstOp op, std::vector<std::shared_ptr<Operand>> regs,
+                 std::shared_ptr<Operand> base, int offs) {
+  m_op = op;
+  m_cond = CondType::NONE;
+  m_regs = regs;
+  m_base = base;
+  m_offs = offs;
+
+  bool is_load
+      = op == InstOp::LDRD || op == InstOp::LDM || op == InstOp::VLDM;
+  for (auto& reg : regs) {
+    if (is_load)
+      addDef(reg);
+    else
+      addUse(reg);
+  }
+  addUse(base);
+}
+
 BInst::BInst(std::shared_ptr<ASM_BasicBlock> block) {
   m_op = InstOp::B;
   m_cond = CondType::NONE;
   m_target = block;
 }
 
-CALLInst::CALLInst(VarType type, std::string label, int n) {
+CALLInst::CALLInst(VarType type, std::string label, int n, int f_n) {
   m_op = InstOp::BL;
   m_cond = CondType::NONE;
   m_type = type;
   m_label = label;
   m_params = n;
+  m_f_params = f_n;
+  m_is_tail = false;
 
   // BL instruction will change LR and R12
   addDef(Operand::getRReg(RReg::R0));
@@ -653,15 +839,11 @@ CALLInst::CALLInst(VarType type, std::string label, int n) {
     addDef(Operand::getSReg((SReg)i));
   }
 
-  if (label == "putfloat") {
-    addUse(Operand::getSReg(SReg::S0));
-    return;
-  }
-
-  int i = 0;
-  while (i < 4 && i < n) {
+  for (int i = 0; i < 4 && i < n; i++) {
     addUse(Operand::getRReg((RReg)i));
-    i++;
+  }
+  for (int i = 0; i < 16 && i < f_n; i++) {
+    addUse(Operand::getSReg((SReg)i));
   }
 }
 
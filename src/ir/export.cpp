@@ -429,6 +429,15 @@ void BitCastInstruction::ExportIR(std::ofstream& ofs, int depth) {
       << g_reg_allocator.GetValueName(m_val->getValue()) << " to "
       << m_target_type << "*" << std::endl;
 }
+void SelectInstruction::ExportIR(std::ofstream& ofs, int depth) {
+  ofs << std::string(depth * 2, ' ');
+  ofs << g_reg_allocator.GetValueName(shared_from_this()) << " = select i1 ";
+  ofs << g_reg_allocator.GetValueName(m_cond->getValue()) << ", ";
+  ofs << m_type << " " << g_reg_allocator.GetValueName(m_true_val->getValue())
+      << ", ";
+  ofs << m_type << " " << g_reg_allocator.GetValueName(m_false_val->getValue())
+      << std::endl;
+}
 void ZExtInstruction::ExportIR(std::ofstream& ofs, int depth) {
   ofs << std::string(depth * 2, ' ');
   ofs << g_reg_allocator.GetValueName(shared_from_this()) << " = zext ";
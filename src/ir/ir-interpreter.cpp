@@ -0,0 +1,420 @@
+//
+// interpreter of the IR, as `bddd --interp`
+//
+// the program reads stdin and writes stdout as the compiled one would, and
+// the number of IR instructions run by each function and block is reported
+// on stderr. it gives the block counts of a run without an ARM machine, and
+// the effect of the passes on the dynamic instruction count
+//
+// arithmetic follows the target rather than C: division by zero gives 0,
+// and float to int conversion saturates
+//
+
+#include "ir/ir-interpreter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "exceptions.h"
+
+// globals start past address 0, so that a null pointer is never valid
+const int MEMORY_BASE = 16;
+// the allocas of all the active calls
+const int STACK_SIZE = 64 << 20;
+
+IRInterpreter::IRInterpreter(std::shared_ptr<IRBuilder> builder)
+    : m_builder(std::move(builder)),
+      m_sp(MEMORY_BASE),
+      m_instructions(0),
+      m_timer_line(0),
+      m_timer_start(0) {
+  auto &module = m_builder->m_module;
+  std::vector<IRWord> init;
+  for (auto &var : module->m_global_variable_list) {
+    m_global_addrs[var.get()] = MEMORY_BASE + init.size() * 4;
+    if (auto int_var = std::dynamic_pointer_cast<IntGlobalVariable>(var)) {
+      for (int val : int_var->m_flatten_vals) init.push_back(IRWord{val});
+    } else {
+      auto float_var = std::dynamic_pointer_cast<FloatGlobalVariable>(var);
+      for (float val : float_var->m_flatten_vals) {
+        init.emplace_back();
+        init.back().m_float = val;
+      }
+    }
+  }
+  m_sp = MEMORY_BASE + init.size() * 4;
+  m_memory.resize(m_sp + STACK_SIZE);
+  memcpy(m_memory.data() + MEMORY_BASE, init.data(), init.size() * 4);
+}
+
+int IRInterpreter::GetSlot(FunctionInfo &info, Value *value) {
+  auto [it, inserted] = info.m_value_slots.emplace(value, info.m_init.size());
+  if (!inserted) return it->second;
+  IRWord word{0};
+  if (auto constant = dynamic_cast<Constant *>(value)) {
+    if (constant->m_type.m_base_type == BasicType::FLOAT)
+      word.m_float = constant->m_float_val;
+    else
+      word.m_int = constant->m_int_val;
+  } else if (auto var = dynamic_cast<GlobalVariable *>(value)) {
+    word.m_int = m_global_addrs.at(var);
+  }
+  info.m_init.push_back(word);
+  return it->second;
+}
+
+IRInterpreter::FunctionInfo &IRInterpreter::GetInfo(Function *func) {
+  auto [it, inserted] = m_infos.try_emplace(func);
+  auto &info = it->second;
+  if (!inserted) return info;
+  info.m_calls = 0;
+  for (auto &arg : func->m_args) GetSlot(info, arg.get());
+  for (auto &bb : func->m_bb_list) {
+    info.m_block_index[bb.get()] = info.m_block_counts.size();
+    info.m_block_counts.push_back(0);
+    for (auto &instr : bb->m_instr_list) {
+      GetSlot(info, instr.get());
+      for (auto use : instr->Operands()) {
+        if (use) info.m_use_slots[use] = GetSlot(info, use->getValue().get());
+      }
+    }
+  }
+  return info;
+}
+
+void IRInterpreter::CheckAddress(int addr, int size) {
+  if (addr < MEMORY_BASE || addr > (int)m_memory.size() - size)
+    throw MyException("access to invalid address " + std::to_string(addr));
+}
+
+int IRInterpreter::Load(int addr) {
+  CheckAddress(addr, 4);
+  int val;
+  memcpy(&val, m_memory.data() + addr, 4);
+  return val;
+}
+
+void IRInterpreter::Store(int addr, int val) {
+  CheckAddress(addr, 4);
+  memcpy(m_memory.data() + addr, &val, 4);
+}
+
+IRWord IRInterpreter::CallBuiltin(const std::string &name,
+                                  const std::vector<IRWord> &args) {
+  IRWord ret{0};
+  if (name == "getint") {
+    if (scanf("%d", &ret.m_int) != 1) ret.m_int = 0;
+  } else if (name == "getch") {
+    ret.m_int = getchar();
+  } else if (name == "getfloat") {
+    if (scanf("%a", &ret.m_float) != 1) ret.m_float = 0;
+  } else if (name == "getarray" || name == "getfarray") {
+    if (scanf("%d", &ret.m_int) != 1) ret.m_int = 0;
+    for (int i = 0; i < ret.m_int; i++) {
+      IRWord val{0};
+      if (name == "getarray")
+        scanf("%d", &val.m_int);
+      else
+        scanf("%a", &val.m_float);
+      Store(args[0].m_int + i * 4, val.m_int);
+    }
+  } else if (name == "putint") {
+    printf("%d", args[0].m_int);
+  } else if (name == "putch") {
+    putchar(args[0].m_int);
+  } else if (name == "putfloat") {
+    printf("%a", args[0].m_float);
+  } else if (name == "putarray" || name == "putfarray") {
+    printf("%d:", args[0].m_int);
+    for (int i = 0; i < args[0].m_int; i++) {
+      IRWord val{Load(args[1].m_int + i * 4)};
+      if (name == "putarray")
+        printf(" %d", val.m_int);
+      else
+        printf(" %a", val.m_float);
+    }
+    printf("\n");
+  } else if (name == "llvm.memset.p0i8.i32") {
+    CheckAddress(args[0].m_int, args[2].m_int);
+    memset(m_memory.data() + args[0].m_int, args[1].m_int, args[2].m_int);
+  } else if (name == "_sysy_starttime") {
+    m_timer_line = args[0].m_int;
+    m_timer_start = m_instructions;
+  } else if (name == "_sysy_stoptime") {
+    m_timers.emplace_back(m_timer_line, args[0].m_int,
+                          m_instructions - m_timer_start);
+  } else {
+    throw MyException("call to unknown function " + name);
+  }
+  return ret;
+}
+
+IRWord IRInterpreter::Call(Function *func, const std::vector<IRWord> &args) {
+  auto &info = GetInfo(func);
+  info.m_calls++;
+  std::vector<IRWord> frame = info.m_init;
+  for (int i = 0; i < args.size(); i++)
+    frame[info.m_value_slots[func->m_args[i].get()]] = args[i];
+  auto get = [&](Use *use) -> IRWord & {
+    return frame[info.m_use_slots.at(use)];
+  };
+  int sp = m_sp;
+
+  std::shared_ptr<BasicBlock> bb = func->m_bb_list.front(), prev = nullptr;
+  std::vector<std::pair<int, IRWord>> phi_vals;
+  while (true) {
+    info.m_block_counts[info.m_block_index.at(bb.get())]++;
+    m_instructions += bb->m_instr_list.size();
+    auto it = bb->m_instr_list.begin();
+
+    // the phis take the values of the edge from prev all at once
+    phi_vals.clear();
+    for (; it != bb->m_instr_list.end() && (*it)->m_op == IROp::PHI; ++it) {
+      auto phi = static_cast<PhiInstruction *>(it->get());
+      auto found = phi->m_contents.find(prev);
+      if (found == phi->m_contents.end())
+        throw MyException("phi without a value from its predecessor");
+      IRWord val{0};  // undefined
+      if (found->second) val = get(found->second);
+      phi_vals.emplace_back(info.m_value_slots[phi], val);
+    }
+    for (auto &[slot, val] : phi_vals) frame[slot] = val;
+
+    std::shared_ptr<BasicBlock> next = nullptr;
+    for (; it != bb->m_instr_list.end() && !next; ++it) {
+      auto instr = it->get();
+      IRWord &dest = frame[info.m_value_slots[instr]];
+      switch (instr->m_op) {
+        case IROp::F_NEG: {
+          auto fneg = static_cast<FNegInstruction *>(instr);
+          dest.m_float = -get(fneg->m_lhs_val_use).m_float;
+          break;
+        }
+        case IROp::CALL: {
+          auto call = static_cast<CallInstruction *>(instr);
+          std::vector<IRWord> params;
+          for (auto use : call->m_params) params.push_back(get(use));
+          if (call->m_function->IsBuiltIn())
+            dest = CallBuiltin(call->m_func_name, params);
+          else
+            dest = Call(call->m_function.get(), params);
+          break;
+        }
+        case IROp::BRANCH: {
+          auto branch = static_cast<BranchInstruction *>(instr);
+          next = get(branch->m_cond).m_int ? branch->m_true_block
+                                           : branch->m_false_block;
+          break;
+        }
+        case IROp::JUMP:
+          next = static_cast<JumpInstruction *>(instr)->m_target_block;
+          break;
+        case IROp::RETURN: {
+          auto ret = static_cast<ReturnInstruction *>(instr);
+          m_sp = sp;
+          return ret->m_ret ? get(ret->m_ret) : IRWord{0};
+        }
+        case IROp::ALLOCA: {
+          int size = 4;
+          for (int dim : instr->m_type.m_dimensions) size *= dim;
+          CheckAddress(m_sp, size);
+          memset(m_memory.data() + m_sp, 0, size);
+          dest.m_int = m_sp;
+          m_sp += size;
+          break;
+        }
+        case IROp::LOAD:
+          dest.m_int = Load(get(static_cast<LoadInstruction *>(instr)->m_addr)
+                                .m_int);
+          break;
+        case IROp::STORE: {
+          auto store = static_cast<StoreInstruction *>(instr);
+          Store(get(store->m_addr).m_int, get(store->m_val).m_int);
+          break;
+        }
+        case IROp::GET_ELEMENT_PTR: {
+          // the same offsets as GenerateGetElementPtr
+          auto gep = static_cast<GetElementPtrInstruction *>(instr);
+          auto &dims = gep->m_addr->getValue()->m_type.m_dimensions;
+          int offs = 0, attribute = 1;
+          for (int i = dims.size(); i >= 0; i--) {
+            if (i < gep->m_indices.size())
+              offs += get(gep->m_indices[i]).m_int * attribute;
+            if (i > 0) attribute *= dims[i - 1];
+          }
+          dest.m_int = get(gep->m_addr).m_int + offs * 4;
+          break;
+        }
+        case IROp::PHI:
+          throw MyException("phi after the start of a block");
+        case IROp::SELECT: {
+          auto select = static_cast<SelectInstruction *>(instr);
+          dest = get(select->m_cond).m_int ? get(select->m_true_val)
+                                           : get(select->m_false_val);
+          break;
+        }
+        case IROp::BITCAST:
+          dest = get(static_cast<BitCastInstruction *>(instr)->m_val);
+          break;
+        case IROp::ZEXT:
+          dest.m_int = get(static_cast<ZExtInstruction *>(instr)->m_val).m_int;
+          break;
+        case IROp::SITOFP:
+          dest.m_float
+              = get(static_cast<SIToFPInstruction *>(instr)->m_val).m_int;
+          break;
+        case IROp::FPTOSI: {
+          float val = get(static_cast<FPToSIInstruction *>(instr)->m_val)
+                          .m_float;
+          if (std::isnan(val))
+            dest.m_int = 0;
+          else if (val >= 2147483648.0f)
+            dest.m_int = std::numeric_limits<int>::max();
+          else if (val < -2147483648.0f)
+            dest.m_int = std::numeric_limits<int>::min();
+          else
+            dest.m_int = (int)val;
+          break;
+        }
+        default: {
+          auto binary = static_cast<BinaryInstruction *>(instr);
+          IRWord lhs = get(binary->m_lhs_val_use);
+          IRWord rhs = get(binary->m_rhs_val_use);
+          // wrapping like the hardware does
+          uint32_t a = lhs.m_int, b = rhs.m_int;
+          float x = lhs.m_float, y = rhs.m_float;
+          switch (binary->m_op) {
+            case IROp::ADD:
+              dest.m_int = a + b;
+              break;
+            case IROp::SUB:
+              dest.m_int = a - b;
+              break;
+            case IROp::MUL:
+              dest.m_int = a * b;
+              break;
+            case IROp::SDIV:
+            case IROp::SREM: {
+              int q = 0;
+              if (rhs.m_int == -1)
+                q = -a;
+              else if (rhs.m_int != 0)
+                q = lhs.m_int / rhs.m_int;
+              dest.m_int = binary->m_op == IROp::SDIV ? q : a - q * b;
+              break;
+            }
+            case IROp::F_ADD:
+              dest.m_float = x + y;
+              break;
+            case IROp::F_SUB:
+              dest.m_float = x - y;
+              break;
+            case IROp::F_MUL:
+              dest.m_float = x * y;
+              break;
+            case IROp::F_DIV:
+              dest.m_float = x / y;
+              break;
+            case IROp::I_SGE:
+              dest.m_int = lhs.m_int >= rhs.m_int;
+              break;
+            case IROp::I_SGT:
+              dest.m_int = lhs.m_int > rhs.m_int;
+              break;
+            case IROp::I_SLE:
+              dest.m_int = lhs.m_int <= rhs.m_int;
+              break;
+            case IROp::I_SLT:
+              dest.m_int = lhs.m_int < rhs.m_int;
+              break;
+            case IROp::I_EQ:
+              dest.m_int = lhs.m_int == rhs.m_int;
+              break;
+            case IROp::I_NE:
+              dest.m_int = lhs.m_int != rhs.m_int;
+              break;
+            case IROp::F_EQ:
+              dest.m_int = x == y;
+              break;
+            case IROp::F_NE:
+              dest.m_int = x != y;
+              break;
+            case IROp::F_GT:
+              dest.m_int = x > y;
+              break;
+            case IROp::F_GE:
+              dest.m_int = x >= y;
+              break;
+            case IROp::F_LT:
+              dest.m_int = x < y;
+              break;
+            case IROp::F_LE:
+              dest.m_int = x <= y;
+              break;
+            case IROp::XOR:
+              dest.m_int = a ^ b;
+              break;
+            default:
+              assert(false);  // unreachable
+          }
+        }
+      }
+    }
+    if (!next) throw MyException("block without a terminator");
+    prev = bb;
+    bb = next;
+  }
+}
+
+int IRInterpreter::Run() {
+  for (auto &func : m_builder->m_module->m_function_list) {
+    if (func->FuncName() != "main") continue;
+    int ret = Call(func.get(), {}).m_int;
+    fflush(stdout);
+    return ret & 0xff;
+  }
+  throw MyException("no main function");
+}
+
+void IRInterpreter::Report(std::ostream &os) {
+  os << "[interp] " << m_instructions << " instructions" << std::endl;
+  for (auto &[start, stop, cnt] : m_timers) {
+    os << "[interp] timer " << start << "-" << stop << ": " << cnt
+       << " instructions" << std::endl;
+  }
+  for (auto &func : m_builder->m_module->m_function_list) {
+    auto found = m_infos.find(func.get());
+    if (found == m_infos.end()) continue;
+    auto &info = found->second;
+    uint64_t total = 0;
+    int index = 0;
+    for (auto &bb : func->m_bb_list)
+      total += info.m_block_counts[index++] * bb->m_instr_list.size();
+    os << "[interp] " << func->FuncName() << ": " << info.m_calls
+       << " calls, " << total << " instructions" << std::endl;
+    index = 0;
+    for (auto &bb : func->m_bb_list) {
+      uint64_t cnt = info.m_block_counts[index++];
+      if (!cnt) continue;
+      os << "[interp]   block " << index - 1 << " (" << bb->Name()
+         << "): " << cnt << " x " << bb->m_instr_list.size() << std::endl;
+    }
+  }
+}
+
+void IRInterpreter::WriteProfile(const std::string &path) {
+  std::ofstream ofs(path, std::ios::binary);
+  for (auto &func : m_builder->m_module->m_function_list) {
+    // a function never called isn't prepared
+    auto found = m_infos.find(func.get());
+    for (int i = 0; i < func->m_bb_list.size(); i++) {
+      uint64_t cnt = 0;
+      if (found != m_infos.end()) cnt = found->second.m_block_counts[i];
+      uint32_t word = std::min<uint64_t>(cnt, UINT32_MAX);
+      ofs.write(reinterpret_cast<char *>(&word), 4);
+    }
+  }
+}
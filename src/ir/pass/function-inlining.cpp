@@ -4,6 +4,12 @@
 #include "ir/ir-pass-manager.h"
 #include "ir/ir.h"
 
+// a function entered at least this many times in the profile may have up to
+// INLINE_HOT_INSTRS instructions instead of INLINE_INSTRS
+const int INLINE_INSTRS = 50;
+const int INLINE_HOT_CALLS = 1000;
+const int INLINE_HOT_INSTRS = 100;
+
 bool FunctionInlining(std::shared_ptr<Function> inline_func) {
   // first identify whether an inline_func can be inlined
   if (inline_func->FuncName() == "main") return false;  // obviously
@@ -23,7 +29,10 @@ bool FunctionInlining(std::shared_ptr<Function> inline_func) {
   }
   auto func_name = inline_func->FuncName();
   // std::cerr << "[debug] # of instrs: " << cnt << std::endl;
-  if (cnt >= 50)
+  double entry_freq = inline_func->m_bb_list.front()->m_frequency;
+  int limit
+      = entry_freq >= INLINE_HOT_CALLS ? INLINE_HOT_INSTRS : INLINE_INSTRS;
+  if (cnt >= limit)
     return false;  // inlined inline_func cannot have too many instructions
 
   std::cerr << "[debug] inlining function " << inline_func->FuncName()
@@ -58,8 +67,15 @@ bool FunctionInlining(std::shared_ptr<Function> inline_func) {
 
     // create basic blocks according to the inline_func (but initially empty)
     std::map<std::shared_ptr<BasicBlock>, std::shared_ptr<BasicBlock>> new_bbs;
+    // the callee runs as often as in the profile, scaled to this call site
+    return_bb->m_frequency = original_bb->m_frequency;
+    double scale = entry_freq > 0 && original_bb->m_frequency >= 0
+                       ? original_bb->m_frequency / entry_freq
+                       : -1;
     for (auto &bb : inline_func->m_bb_list) {
       auto new_bb = std::make_shared<BasicBlock>(bb->Name() + "(inlined)");
+      if (scale >= 0 && bb->m_frequency >= 0)
+        new_bb->m_frequency = bb->m_frequency * scale;
       new_bbs[bb] = new_bb;
       original_func->m_bb_list.insert(return_bb_it, new_bb);
     }
@@ -122,6 +138,18 @@ bool FunctionInlining(std::shared_ptr<Function> inline_func) {
               = GetNewVal(bit_cast->m_val->getValue())->AddUse(new_bit_cast);
           new_bb->PushBackInstruction(new_bit_cast);
           new_vals[bit_cast] = new_bit_cast;
+        } else if (auto select
+                   = std::dynamic_pointer_cast<SelectInstruction>(instr)) {
+          auto new_select
+              = std::make_shared<SelectInstruction>(select->m_type, new_bb);
+          new_select->m_cond
+              = GetNewVal(select->m_cond->getValue())->AddUse(new_select);
+          new_select->m_true_val
+              = GetNewVal(select->m_true_val->getValue())->AddUse(new_select);
+          new_select->m_false_val
+              = GetNewVal(select->m_false_val->getValue())->AddUse(new_select);
+          new_bb->PushBackInstruction(new_select);
+          new_vals[select] = new_select;
         } else if (auto zext
                    = std::dynamic_pointer_cast<ZExtInstruction>(instr)) {
           auto new_zext = std::make_shared<ZExtInstruction>(new_bb);
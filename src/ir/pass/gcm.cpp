@@ -13,6 +13,7 @@ bool IsPinned(std::shared_ptr<Instruction> instr) {
     return call_instr->HasSideEffect();
   }
   if (instr->m_op == IROp::GET_ELEMENT_PTR) return false;
+  // select is pinned, it stays in the block where its diamond was folded
   return true;
 }
 
@@ -377,6 +377,25 @@ std::shared_ptr<Value> GetValueForBinaryInstr(
   return instr;
 }
 
+// selects are pinned in gcm, so identical selects are not merged here
+std::shared_ptr<Value> GetValueForSelectInstr(
+    std::shared_ptr<SelectInstruction> instr,
+    std::shared_ptr<IRBuilder> builder) {
+  auto cond = instr->m_cond->getValue();
+  if (cond->m_type.IsConst()) {
+    auto c = std::dynamic_pointer_cast<Constant>(cond);
+    if (c->Evaluate().IsNotZero())
+      return GetValue(instr->m_true_val->getValue(), builder);
+    else
+      return GetValue(instr->m_false_val->getValue(), builder);
+  }
+  if (GetValueNumber(instr->m_true_val->getValue(), builder)
+      == GetValueNumber(instr->m_false_val->getValue(), builder)) {
+    return GetValue(instr->m_true_val->getValue(), builder);
+  }
+  return instr;
+}
+
 std::shared_ptr<Value> GetValue(std::shared_ptr<Value> val,
                                 std::shared_ptr<IRBuilder> builder) {
   auto it = g_idx.find(val);
@@ -400,6 +419,9 @@ std::shared_ptr<Value> GetValue(std::shared_ptr<Value> val,
   } else if (auto gep_instr
              = std::dynamic_pointer_cast<GetElementPtrInstruction>(val)) {
     g_vns[idx].second = GetValueForGEPInstr(gep_instr, builder);
+  } else if (auto select_instr
+             = std::dynamic_pointer_cast<SelectInstruction>(val)) {
+    g_vns[idx].second = GetValueForSelectInstr(select_instr, builder);
   } else if (auto zext_instr
              = std::dynamic_pointer_cast<ZExtInstruction>(val)) {
     // i1 to i32
@@ -458,6 +480,7 @@ bool CanGVN(std::shared_ptr<Instruction> instr) {
     case IROp::GET_ELEMENT_PTR:
     case IROp::XOR:
     case IROp::CALL:
+    case IROp::SELECT:
       return true;
     case IROp::BRANCH:
     case IROp::JUMP:
@@ -493,6 +516,8 @@ void RunGVN(std::shared_ptr<Function> function,
         g_idx.erase(instr);
         std::swap(g_vns[idx], g_vns.back());
         g_vns.pop_back();
+        // the moved entry's index has changed
+        if (idx < g_vns.size()) g_idx[g_vns[idx].first] = idx;
         auto del = it;
         ++it;
         // cannot really remove it, since it may be referenced in GVN later on
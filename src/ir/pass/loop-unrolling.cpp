@@ -7,6 +7,22 @@
 
 const int K = 4;
 
+// the profile counts after unrolling, each time the loop is entered its head
+// runs once more than its body, and the loop left over takes (K - 1) / 2
+// iterations on average
+void ScaleUnrolledFrequency(std::shared_ptr<EasyLoop> easy_loop,
+                            std::shared_ptr<EasyLoop> reset_easy_loop) {
+  auto cond_bb = easy_loop->m_cond_bb, body_bb = easy_loop->m_body_bb;
+  if (cond_bb->m_frequency < 0 || body_bb->m_frequency < 0) return;
+  double entries = std::max(cond_bb->m_frequency - body_bb->m_frequency, 0.0);
+  body_bb->m_frequency /= K;
+  cond_bb->m_frequency = entries + body_bb->m_frequency;
+  if (!reset_easy_loop) return;
+  reset_easy_loop->m_body_bb->m_frequency = entries * (K - 1) / 2;
+  reset_easy_loop->m_cond_bb->m_frequency
+      = entries + reset_easy_loop->m_body_bb->m_frequency;
+}
+
 void CopyInstructions(
     const std::vector<std::shared_ptr<Instruction>> &original_instrs,
     std::shared_ptr<BasicBlock> bb, std::shared_ptr<EasyLoop> easy_loop,
@@ -57,6 +73,17 @@ void CopyInstructions(
           = GetNewVal(bitcast->m_val->getValue())->AddUse(new_bitcast);
       bb->PushBackInstruction(new_bitcast);
       new_vals[bitcast] = new_bitcast;
+    } else if (auto select
+               = std::dynamic_pointer_cast<SelectInstruction>(instr)) {
+      auto new_select = std::make_shared<SelectInstruction>(select->m_type, bb);
+      new_select->m_cond
+          = GetNewVal(select->m_cond->getValue())->AddUse(new_select);
+      new_select->m_true_val
+          = GetNewVal(select->m_true_val->getValue())->AddUse(new_select);
+      new_select->m_false_val
+          = GetNewVal(select->m_false_val->getValue())->AddUse(new_select);
+      bb->PushBackInstruction(new_select);
+      new_vals[select] = new_select;
     } else if (auto zext = std::dynamic_pointer_cast<ZExtInstruction>(instr)) {
       auto new_zext = std::make_shared<ZExtInstruction>(bb);
       new_zext->m_val = GetNewVal(zext->m_val->getValue())->AddUse(new_zext);
@@ -249,6 +276,16 @@ void InsertResetLoop(
   reset_easy_loop->m_cond_bb->AddPredecessor(reset_easy_loop->m_body_bb);
   reset_easy_loop->m_body_bb->AddPredecessor(reset_easy_loop->m_cond_bb);
   out_block->AddPredecessor(reset_easy_loop->m_cond_bb);
+  // the exit is now entered from the reset loop, so are its phis
+  for (auto &instr : out_block->m_instr_list) {
+    auto phi = std::dynamic_pointer_cast<PhiInstruction>(instr);
+    if (!phi) break;
+    auto it = phi->m_contents.find(easy_loop->m_cond_bb);
+    if (it == phi->m_contents.end()) continue;
+    auto val = it->second != nullptr ? it->second->getValue() : nullptr;
+    phi->RemoveByBasicBlock(easy_loop->m_cond_bb);
+    phi->AddPhiOperand(reset_easy_loop->m_cond_bb, val);
+  }
   reset_loop->m_preheaders.insert(easy_loop->m_cond_bb);
   reset_loop->m_loop_depth = easy_loop->m_loop->m_loop_depth;
 
@@ -431,6 +468,7 @@ bool unroll(std::shared_ptr<Function> func, std::shared_ptr<Loop> loop,
     }
   }
   assert(cnt == 0);
+  if (loop_body->m_frequency == 0) return false;  // never runs in the profile
   for (auto &instr : loop_body->m_instr_list) {
     if (instr->m_op == IROp::RETURN || instr->m_op == IROp::PHI) return false;
   }
@@ -486,6 +524,9 @@ bool unroll(std::shared_ptr<Function> func, std::shared_ptr<Loop> loop,
         reset_easy_loop->m_body_bb->m_instr_list.push_back(reset_jmp_instr);
       }
       MakeRunOnce(reset_easy_loop);
+      ScaleUnrolledFrequency(easy_loop, reset_easy_loop);
+    } else {
+      ScaleUnrolledFrequency(easy_loop, nullptr);
     }
     if (exec_cnt == 1) {
       MakeRunOnce(easy_loop);
@@ -508,6 +549,7 @@ bool unroll(std::shared_ptr<Function> func, std::shared_ptr<Loop> loop,
     auto reset_easy_loop = std::make_shared<EasyLoop>();
     InsertResetLoop(func, reset_easy_loop, easy_loop, original_instrs);
     FixUnrollLoopCond(easy_loop, easy_loop->m_stride, 233, builder);
+    ScaleUnrolledFrequency(easy_loop, reset_easy_loop);
     return true;
   } else {
     return false;
@@ -0,0 +1,94 @@
+//
+// profile-guided optimization
+//
+// -fprofile-generate[=file] counts the executions of every block in
+// PROFILE_COUNTS, and main writes the counts to the file (bddd.profile by
+// default) as raw 32-bit words before it returns. the program is run on
+// typical input, under qemu-arm on a development machine:
+//
+//   bddd -S -o a.s a.sy -O2 -fprofile-generate
+//   arm-linux-gnueabihf-gcc -static a.s sylib.a -o a && qemu-arm ./a < a.in
+//   bddd -S -o a.s a.sy -O2 -fprofile-use
+//
+// -fprofile-use[=file] puts the counts back in BasicBlock::m_frequency. the
+// blocks are numbered in the order they are generated in, both passes run
+// before any other one
+//
+
+#include <fstream>
+
+#include "ir/ir-pass-manager.h"
+
+// counts the executions of bb in counts[index], right before it leaves
+void InsertCounter(std::shared_ptr<IRBuilder> builder,
+                   std::shared_ptr<BasicBlock> bb,
+                   std::shared_ptr<GlobalVariable> counts, int index) {
+  auto terminator = bb->LastInstruction();
+  auto gep = std::make_shared<GetElementPtrInstruction>(bb);
+  gep->m_addr = counts->AddUse(gep);
+  gep->m_indices.push_back(builder->GetIntConstant(0)->AddUse(gep));
+  gep->m_indices.push_back(builder->GetIntConstant(index)->AddUse(gep));
+  gep->m_type.Set(BasicType::INT, true);
+  bb->InsertFrontInstruction(terminator, gep);
+
+  auto load = std::make_shared<LoadInstruction>(bb);
+  load->m_addr = gep->AddUse(load);
+  load->m_type = gep->m_type.Dereference();
+  bb->InsertFrontInstruction(terminator, load);
+
+  auto add = std::make_shared<BinaryInstruction>(IROp::ADD, bb);
+  add->m_lhs_val_use = load->AddUse(add);
+  add->m_rhs_val_use = builder->GetIntConstant(1)->AddUse(add);
+  bb->InsertFrontInstruction(terminator, add);
+
+  auto store = std::make_shared<StoreInstruction>(bb);
+  store->m_addr = gep->AddUse(store);
+  store->m_val = add->AddUse(store);
+  bb->InsertFrontInstruction(terminator, store);
+}
+
+void IRPassManager::ProfileGeneratePass() {
+  auto &module = m_builder->m_module;
+  int cnt = 0;
+  for (auto &func : module->m_function_list) cnt += func->m_bb_list.size();
+  auto counts = std::make_shared<IntGlobalVariable>(PROFILE_COUNTS, cnt);
+  module->AppendGlobalVariable(counts);
+  auto dump = std::make_shared<Function>(
+      std::make_shared<FuncDefAST>(VarType::VOID, PROFILE_DUMP, nullptr, true));
+  module->AppendFunctionDecl(dump);
+
+  int index = 0;
+  for (auto &func : module->m_function_list) {
+    for (auto &bb : func->m_bb_list) {
+      InsertCounter(m_builder, bb, counts, index++);
+      auto ret = bb->LastInstruction();
+      if (func->FuncName() != "main" || ret->m_op != IROp::RETURN) continue;
+      auto call = std::make_shared<CallInstruction>(VarType::VOID,
+                                                    PROFILE_DUMP, bb);
+      call->m_function = dump;
+      bb->InsertFrontInstruction(ret, call);
+    }
+  }
+  std::cerr << "[debug] profile counters x" << cnt << std::endl;
+}
+
+bool IRPassManager::ProfileUsePass(const std::string &path) {
+  auto &module = m_builder->m_module;
+  int cnt = 0;
+  for (auto &func : module->m_function_list) cnt += func->m_bb_list.size();
+
+  std::ifstream ifs(path, std::ios::binary);
+  std::vector<uint32_t> counts(cnt);
+  if (!ifs.read(reinterpret_cast<char *>(counts.data()), cnt * 4)
+      || ifs.peek() != EOF) {
+    std::cerr << "profile " << path << " doesn't match the program, ignored"
+              << std::endl;
+    return false;
+  }
+
+  int index = 0;
+  for (auto &func : module->m_function_list) {
+    for (auto &bb : func->m_bb_list) bb->m_frequency = counts[index++];
+  }
+  return true;
+}
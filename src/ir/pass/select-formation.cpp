@@ -0,0 +1,187 @@
+//
+// fold small diamonds and triangles into select instructions
+//
+//   head:                        head:
+//     %c = icmp ...                %c = icmp ...
+//     br %c, %then, %else          %x = ...  (hoisted from then)
+//   then:                          %y = ...  (hoisted from else)
+//     %x = ...                     %r = select i1 %c, %x, %y
+//     br %join                     br %join
+//   else:                        join:
+//     %y = ...                     ...
+//     br %join
+//   join:
+//     %r = phi [%x, %then], [%y, %else]
+//
+
+#include "ir/ir-pass-manager.h"
+
+// max number of instructions (hoisted ones and selects) a fold may add to
+// the head block, a mispredicted branch costs about this much on cortex-a7
+const int SELECT_LIMIT = 6;
+
+// the condition must be a comparison (maybe negated by xor), since codegen
+// re-evaluates it right before the conditional moves
+bool IsSelectCondition(std::shared_ptr<Value> cond) {
+  auto binary = std::dynamic_pointer_cast<BinaryInstruction>(cond);
+  while (binary && binary->m_op == IROp::XOR) {
+    binary = std::dynamic_pointer_cast<BinaryInstruction>(
+        binary->m_lhs_val_use->getValue());
+  }
+  return binary && (binary->IsICmp() || binary->IsFCmp());
+}
+
+bool IsSpeculatable(std::shared_ptr<Instruction> instr) {
+  if (instr->m_op == IROp::F_NEG) return true;
+  auto binary = std::dynamic_pointer_cast<BinaryInstruction>(instr);
+  if (binary == nullptr) return false;
+  switch (binary->m_op) {
+    case IROp::ADD:
+    case IROp::F_ADD:
+    case IROp::SUB:
+    case IROp::F_SUB:
+    case IROp::MUL:
+    case IROp::F_MUL:
+      return true;
+    default:
+      // divisions are too expensive to be executed on both sides
+      return false;
+  }
+}
+
+// number of instructions to be hoisted from arm, -1 if it cannot be hoisted
+int CountSpeculatable(std::shared_ptr<BasicBlock> arm,
+                      std::shared_ptr<BasicBlock> head,
+                      std::shared_ptr<BasicBlock> join) {
+  if (arm == head) return 0;
+  auto preds = arm->Predecessors();
+  if (preds.size() != 1 || *preds.begin() != head) return -1;
+  auto jump_instr
+      = std::dynamic_pointer_cast<JumpInstruction>(arm->LastInstruction());
+  if (jump_instr == nullptr || jump_instr->m_target_block != join) return -1;
+  int cnt = 0;
+  for (auto &instr : arm->m_instr_list) {
+    if (instr == jump_instr) break;
+    if (!IsSpeculatable(instr)) return -1;
+    ++cnt;
+  }
+  return cnt;
+}
+
+void HoistInstructions(std::shared_ptr<BasicBlock> arm,
+                       std::shared_ptr<BasicBlock> head,
+                       std::shared_ptr<Instruction> pos) {
+  if (arm == head) return;
+  while (arm->m_instr_list.size() > 1) {
+    auto instr = arm->m_instr_list.front();
+    arm->m_instr_list.pop_front();
+    head->InsertFrontInstruction(pos, instr);
+  }
+}
+
+bool FoldDiamond(std::shared_ptr<BasicBlock> head,
+                 std::shared_ptr<Function> func) {
+  auto br_instr
+      = std::dynamic_pointer_cast<BranchInstruction>(head->LastInstruction());
+  if (br_instr == nullptr) return false;
+  auto cond = br_instr->m_cond->getValue();
+  if (!IsSelectCondition(cond)) return false;
+
+  // then_bb or else_bb is head itself for a triangle
+  std::shared_ptr<BasicBlock> then_bb, else_bb, join;
+  auto true_block = br_instr->m_true_block;
+  auto false_block = br_instr->m_false_block;
+  if (true_block == false_block) return false;
+  auto true_succs = true_block->Successors();
+  auto false_succs = false_block->Successors();
+  if (true_succs.size() == 1 && false_succs.size() == 1
+      && true_succs[0] == false_succs[0]) {
+    then_bb = true_block;
+    else_bb = false_block;
+    join = true_succs[0];
+  } else if (true_succs.size() == 1 && true_succs[0] == false_block) {
+    then_bb = true_block;
+    else_bb = head;
+    join = false_block;
+  } else if (false_succs.size() == 1 && false_succs[0] == true_block) {
+    then_bb = head;
+    else_bb = false_block;
+    join = true_block;
+  } else {
+    return false;
+  }
+  if (join == head || then_bb == join || else_bb == join) return false;
+
+  int then_cnt = CountSpeculatable(then_bb, head, join);
+  int else_cnt = CountSpeculatable(else_bb, head, join);
+  if (then_cnt < 0 || else_cnt < 0) return false;
+
+  std::vector<std::shared_ptr<PhiInstruction>> phis;
+  for (auto &instr : join->m_instr_list) {
+    auto phi = std::dynamic_pointer_cast<PhiInstruction>(instr);
+    if (phi == nullptr) break;
+    if (!phi->m_type.IsBasicInt() && !phi->m_type.IsBasicFloat())
+      return false;
+    if (phi->GetValue(then_bb) == nullptr || phi->GetValue(else_bb) == nullptr)
+      return false;  // undef
+    phis.push_back(phi);
+  }
+  if (then_cnt + else_cnt + (int)phis.size() > SELECT_LIMIT) return false;
+
+  HoistInstructions(then_bb, head, br_instr);
+  HoistInstructions(else_bb, head, br_instr);
+  for (auto &phi : phis) {
+    auto true_val = phi->GetValue(then_bb);
+    auto false_val = phi->GetValue(else_bb);
+    std::shared_ptr<Value> val = true_val;
+    if (true_val != false_val) {
+      auto select = std::make_shared<SelectInstruction>(phi->m_type, head);
+      select->m_cond = cond->AddUse(select);
+      select->m_true_val = true_val->AddUse(select);
+      select->m_false_val = false_val->AddUse(select);
+      head->InsertFrontInstruction(br_instr, select);
+      val = select;
+    }
+    if (then_bb != head) phi->RemoveByBasicBlock(then_bb);
+    if (else_bb != head) phi->RemoveByBasicBlock(else_bb);
+    if (then_bb == head || else_bb == head)
+      phi->ReplacePhiValue(head, val);
+    else
+      phi->AddPhiOperand(head, val);
+  }
+
+  // head -> join
+  for (auto &arm : {then_bb, else_bb}) {
+    if (arm == head) continue;
+    join->m_predecessors.erase(arm);
+    arm->RemoveInstruction(arm->LastInstruction());
+    func->m_bb_list.remove(arm);
+  }
+  join->m_predecessors.insert(head);
+  head->RemoveInstruction(br_instr);
+  head->PushBackInstruction(std::make_shared<JumpInstruction>(join, head));
+  return true;
+}
+
+void IRPassManager::SelectFormationPass() {
+  for (auto &func : m_builder->m_module->m_function_list) {
+    if (func->m_bb_list.empty()) continue;
+    int cnt = 0;
+    while (true) {
+      bool changed = false;
+      // the fold removes blocks after head, so restart after each one
+      for (auto &bb : func->m_bb_list) {
+        if (FoldDiamond(bb, func)) {
+          changed = true;
+          ++cnt;
+          break;
+        }
+      }
+      if (!changed) break;
+    }
+    if (cnt) {
+      std::cerr << "[debug] select formation x" << cnt << std::endl;
+      BasicOptimization(func);
+    }
+  }
+}
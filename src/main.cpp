@@ -5,11 +5,14 @@
 
 #include "asm/asm-builder.h"
 #include "asm/asm-fixed.h"
+#include "asm/asm-frame.h"
 #include "asm/asm-optimization.h"
 #include "asm/asm-register.h"
+#include "asm/asm-stack.h"
 #include "asm/asm.h"
 #include "ast/symbol-table.h"
 #include "exceptions.h"
+#include "ir/ir-interpreter.h"
 #include "ir/ir-pass-manager.h"
 #include "ir/ir.h"
 #include "parser/driver.h"
@@ -20,16 +23,52 @@ static const struct option long_options[]
        {"optimization", required_argument, nullptr, 'O'},
        {"output-ir", required_argument, nullptr, 'i'},
        {"output-tmp-asm", required_argument, nullptr, 't'},
+       {"linear-scan", no_argument, nullptr, 'l'},
+       {"profile-generate", optional_argument, nullptr, 'g'},
+       {"profile-use", optional_argument, nullptr, 'u'},
+       {"interp", no_argument, nullptr, 'r'},
        {nullptr, no_argument, nullptr, 0}};
 
+// runs the IR for --interp, returns the program's exit code, the dynamic
+// counts go to stderr and the block counts to profile_path if given
+static int Interpret(std::shared_ptr<IRBuilder> builder,
+                     const std::string *profile_path) {
+  IRInterpreter interpreter(builder);
+  int exit_code;
+  try {
+    exit_code = interpreter.Run();
+  } catch (MyException &e) {
+    std::cerr << "exception during interpretation: " << e.Msg() << std::endl;
+    return 1;
+  }
+  if (profile_path) interpreter.WriteProfile(*profile_path);
+  interpreter.Report(std::cerr);
+  return exit_code;
+}
+
 int main(int argc, char *argv[]) {
   int ch;
   bool optimization = false;
+  bool linear_scan = false;
   const char *asm_path = nullptr;
   const char *ir_path = nullptr;
   const char *tmp_asm_path = nullptr;
-  while ((ch = getopt_long(argc, argv, "So:O:i:t:", long_options, NULL))
+  // -fprofile-generate and -fprofile-use, with the default file if no path
+  bool profile_generate = false;
+  bool profile_use = false;
+  std::string profile_path = "bddd.profile";
+  // run the IR instead of compiling it, the program's output goes to stdout
+  bool interp = false;
+  while ((ch = getopt_long(argc, argv, "So:O:i:t:lf:", long_options, NULL))
          != -1) {
+    // -fname[=arg] is the same as --name[=arg]
+    if (ch == 'f') {
+      std::string flag = optarg;
+      auto eq = flag.find('=');
+      if (flag.substr(0, eq) == "profile-generate") ch = 'g';
+      if (flag.substr(0, eq) == "profile-use") ch = 'u';
+      optarg = eq == std::string::npos ? nullptr : optarg + eq + 1;
+    }
     switch (ch) {
       case 'S':
         break;
@@ -45,6 +84,20 @@ int main(int argc, char *argv[]) {
       case 't':
         tmp_asm_path = optarg;
         break;
+      case 'l':
+        linear_scan = true;
+        break;
+      case 'g':
+        profile_generate = true;
+        if (optarg) profile_path = optarg;
+        break;
+      case 'u':
+        profile_use = true;
+        if (optarg) profile_path = optarg;
+        break;
+      case 'r':
+        interp = true;
+        break;
       default:
         return -1;
     }
@@ -58,8 +111,9 @@ int main(int argc, char *argv[]) {
   }
 
   auto src_path = argv[optind];
-  std::cout << "compiling: " << src_path << std::endl;
-  std::cout << "parsing..." << std::endl;
+  std::ostream &progress = interp ? std::cerr : std::cout;
+  progress << "compiling: " << src_path << std::endl;
+  progress << "parsing..." << std::endl;
   /**
    * parse the source code into AST
    * ASTs can be accessed via driver.comp_unit
@@ -78,7 +132,7 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  std::cout << "generating ir..." << std::endl;
+  progress << "generating ir..." << std::endl;
 
   auto module = std::make_unique<Module>();
   for (auto &builtin_func : g_builtin_funcs) {
@@ -95,12 +149,17 @@ int main(int argc, char *argv[]) {
   builder->m_module->RemoveInstrsAfterTerminator();
 
   auto pass_manager = std::make_unique<IRPassManager>(builder);
+  // the block counts of the interpreter are the profile, no ARM host needed
+  if (interp && profile_generate) return Interpret(builder, &profile_path);
+  if (profile_generate) pass_manager->ProfileGeneratePass();
+  if (profile_use) pass_manager->ProfileUsePass(profile_path);
   if (optimization) {
     pass_manager->Mem2RegPass();
     pass_manager->EliminateGlobalConstArrayAccess();
     pass_manager->TailRecursionPass();
     pass_manager->FunctionInliningPass();
     pass_manager->LoadStoreOptimizationPass();
+    pass_manager->SelectFormationPass();
     pass_manager->LoopUnrollingPass();
     pass_manager->LoopSimplifyPass();
     pass_manager->StrengthReductionPass();
@@ -124,11 +183,14 @@ int main(int argc, char *argv[]) {
     ofs.close();
   }
 
+  if (interp) return Interpret(builder, nullptr);
+
   if (tmp_asm_path == nullptr && asm_path == nullptr) return 0;
   std::cout << "generating asm..." << std::endl;
 
   // generate assembly
   auto asm_module = std::make_shared<ASM_Module>();
+  if (profile_generate) asm_module->m_profile_path = profile_path;
   auto asm_builder = std::make_shared<ASM_Builder>(asm_module);
   GenerateModule(std::move(builder->m_module), asm_builder);
 
@@ -144,13 +206,17 @@ int main(int argc, char *argv[]) {
   std::cout << "allocating..." << std::endl;
 
   // register allocator
-  RegisterAllocator(asm_module, RegType::S).Allocate();
-  RegisterAllocator(asm_module, RegType::R).Allocate();
+  RegisterAllocator(asm_module, RegType::S, linear_scan).Allocate();
+  RegisterAllocator(asm_module, RegType::R, linear_scan).Allocate();
+  if (optimization) colorStackSlots(asm_module);
 
   // fixing and optimization
   fixedParamsOffs(asm_module);
-  optimize(asm_module);
-  generateLiteralPool(asm_module);
+  optimize(asm_module, optimization);
+  if (optimization) {
+    markTailCalls(asm_module);
+    shrinkWrap(asm_module);
+  }
   std::ofstream ofs(asm_path);
   asm_module->exportASM(ofs);
   ofs.close();
@@ -0,0 +1,1154 @@
+//
+// bddd-sim a.s < a.in
+//
+// runs the assembly of bddd -S on the host. only the mnemonics and operand
+// forms the exporter writes are understood, anything else is an error, so
+// that the backend can't emit code the simulator silently gets wrong.
+// besides the output and the exit code of the program, it reports the
+// executed instructions, the cycles of an in-order core with the latencies
+// of the scheduler, the loads and stores (the spill code is marked by the
+// exporter) and the blocks taking the most cycles
+//
+
+#include "sim/arm-simulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "exceptions.h"
+
+// the data starts above an unmapped page, code addresses are above the data
+// and only used for return addresses
+const uint32_t DATA_BASE = 0x1000;
+const uint32_t TEXT_BASE = 0xf0000000;
+const uint32_t EXIT_ADDR = TEXT_BASE - 4;
+const uint32_t CLOBBER = 0xdeadbeef;
+
+static const std::vector<std::pair<std::string, SimOp>> g_mnemonics = {
+    {"LDR", SimOp::LDR},     {"STR", SimOp::STR},     {"LDRD", SimOp::LDRD},
+    {"STRD", SimOp::STRD},   {"LDM", SimOp::LDM},     {"STM", SimOp::STM},
+    {"MOV", SimOp::MOV},     {"MOVW", SimOp::MOVW},   {"MOVT", SimOp::MOVT},
+    {"MVN", SimOp::MVN},     {"PUSH", SimOp::PUSH},   {"POP", SimOp::POP},
+    {"B", SimOp::B},         {"BL", SimOp::BL},       {"BX", SimOp::BX},
+    {"SVC", SimOp::SVC},     {"LSL", SimOp::LSL},     {"LSR", SimOp::LSR},
+    {"ASR", SimOp::ASR},     {"ROR", SimOp::ROR},     {"ADD", SimOp::ADD},
+    {"SUB", SimOp::SUB},     {"RSB", SimOp::RSB},     {"MLA", SimOp::MLA},
+    {"MLS", SimOp::MLS},     {"MUL", SimOp::MUL},     {"SMMLA", SimOp::SMMLA},
+    {"SMMLS", SimOp::SMMLS}, {"SMMUL", SimOp::SMMUL}, {"SDIV", SimOp::SDIV},
+    {"AND", SimOp::AND},     {"ORR", SimOp::ORR},     {"EOR", SimOp::EOR},
+    {"BIC", SimOp::BIC},     {"CMP", SimOp::CMP},     {"TST", SimOp::TST},
+    {"VMOV", SimOp::VMOV},   {"VADD", SimOp::VADD},   {"VSUB", SimOp::VSUB},
+    {"VMLA", SimOp::VMLA},   {"VMLS", SimOp::VMLS},   {"VMUL", SimOp::VMUL},
+    {"VDIV", SimOp::VDIV},   {"VNEG", SimOp::VNEG},   {"VCMP", SimOp::VCMP},
+    {"VMRS", SimOp::VMRS},   {"VLDR", SimOp::VLDR},   {"VSTR", SimOp::VSTR},
+    {"VPUSH", SimOp::VPUSH}, {"VPOP", SimOp::VPOP},   {"VLDM", SimOp::VLDM},
+    {"VSTM", SimOp::VSTM},   {"VCVT", SimOp::VCVT}};
+
+static const std::vector<std::pair<std::string, CondType>> g_conds = {
+    {"EQ", CondType::EQ}, {"NE", CondType::NE}, {"CS", CondType::CS},
+    {"CC", CondType::CC}, {"MI", CondType::MI}, {"PL", CondType::PL},
+    {"VS", CondType::VS}, {"VC", CondType::VC}, {"HI", CondType::HI},
+    {"LS", CondType::LS}, {"GE", CondType::GE}, {"LT", CondType::LT},
+    {"GT", CondType::GT}, {"LE", CondType::LE}};
+
+bool setsFlagOptionally(SimOp op) {
+  switch (op) {
+    case SimOp::MOV:
+    case SimOp::MVN:
+    case SimOp::LSL:
+    case SimOp::LSR:
+    case SimOp::ASR:
+    case SimOp::ROR:
+    case SimOp::ADD:
+    case SimOp::SUB:
+    case SimOp::RSB:
+    case SimOp::MUL:
+    case SimOp::MLA:
+    case SimOp::AND:
+    case SimOp::ORR:
+    case SimOp::EOR:
+    case SimOp::BIC:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool parseCond(const std::string& str, CondType& cond) {
+  if (str.empty()) {
+    cond = CondType::NONE;
+    return true;
+  }
+  for (auto& [name, c] : g_conds) {
+    if (str == name) {
+      cond = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+// -1 if str is no register
+int parseReg(const std::string& str) {
+  if (str == "SP") return 13;
+  if (str == "LR") return 14;
+  if (str == "PC") return 15;
+  if (str.size() < 2 || (str[0] != 'R' && str[0] != 'S')) return -1;
+  for (int i = 1; i < str.size(); i++) {
+    if (!isdigit(str[i])) return -1;
+  }
+  int n = std::stoi(str.substr(1));
+  if (str[0] == 'R') return n < 16 ? n : -1;
+  return n < 32 ? 16 + n : -1;
+}
+
+// splits at the commas outside brackets and braces
+std::vector<std::string> splitOperands(const std::string& str) {
+  std::vector<std::string> ret;
+  std::string cur;
+  int depth = 0;
+  for (char ch : str) {
+    if (ch == '[' || ch == '{') depth++;
+    if (ch == ']' || ch == '}') depth--;
+    if (ch == ',' && depth == 0) {
+      ret.push_back(cur);
+      cur.clear();
+    } else if (ch != ' ' || !cur.empty()) {
+      cur += ch;
+    }
+  }
+  if (!cur.empty()) ret.push_back(cur);
+  for (auto& op : ret) {
+    while (!op.empty() && op.back() == ' ') op.pop_back();
+  }
+  return ret;
+}
+
+uint32_t floatBits(float val) {
+  uint32_t bits;
+  memcpy(&bits, &val, 4);
+  return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+  float val;
+  memcpy(&val, &bits, 4);
+  return val;
+}
+
+uint32_t shiftValue(SimOp kind, uint32_t val, int amt) {
+  switch (kind) {
+    case SimOp::LSL:
+      return amt >= 32 ? 0 : val << amt;
+    case SimOp::LSR:
+      return amt >= 32 ? 0 : val >> amt;
+    case SimOp::ASR:
+      return (int32_t)val >> std::min(amt, 31);
+    case SimOp::ROR:
+      amt &= 31;
+      return amt ? (val >> amt) | (val << (32 - amt)) : val;
+    default:
+      throw MyException("bad shift");
+  }
+}
+
+int latencyOf(SimOp op, bool has_shift) {
+  switch (op) {
+    case SimOp::LDR:
+    case SimOp::VLDR:
+    case SimOp::LDRD:
+    case SimOp::LDM:
+    case SimOp::VLDM:
+    case SimOp::POP:
+    case SimOp::VPOP:
+      return LOAD_LATENCY;
+    case SimOp::MUL:
+    case SimOp::MLA:
+    case SimOp::MLS:
+      return MUL_LATENCY;
+    case SimOp::SMMUL:
+    case SimOp::SMMLA:
+    case SimOp::SMMLS:
+      return SMMUL_LATENCY;
+    case SimOp::SDIV:
+      return SDIV_LATENCY;
+    case SimOp::VMOV:
+    case SimOp::VNEG:
+      return VMOV_LATENCY;
+    case SimOp::VADD:
+    case SimOp::VSUB:
+    case SimOp::VMUL:
+    case SimOp::VCVT:
+    case SimOp::VCMP:
+      return VFP_LATENCY;
+    case SimOp::VMLA:
+    case SimOp::VMLS:
+      return VMLA_LATENCY;
+    case SimOp::VDIV:
+      return VDIV_LATENCY;
+    case SimOp::MOV:
+    case SimOp::MOVW:
+    case SimOp::MOVT:
+      return MOV_LATENCY;
+    case SimOp::LSL:
+    case SimOp::LSR:
+    case SimOp::ASR:
+    case SimOp::ROR:
+      return ALU_LATENCY;
+    default:
+      return has_shift ? ALU_SHIFT_LATENCY : ALU_LATENCY;
+  }
+}
+
+ARMSimulator::ARMSimulator(std::istream& is)
+    : m_data_end(DATA_BASE),
+      m_cycles(0),
+      m_steps(0),
+      m_loads(0),
+      m_stores(0),
+      m_spill_loads(0),
+      m_spill_stores(0),
+      m_taken_branches(0),
+      m_calls(0),
+      m_timer_line(0),
+      m_timer_start(0) {
+  m_memory.resize(DATA_BASE);
+  load(is);
+  resolve();
+  m_memory.resize(((m_data_end + 7) & ~7) + SIM_STACK_SIZE);
+  m_inst_counts.resize(m_insts.size());
+  m_inst_cycles.resize(m_insts.size());
+}
+
+void ARMSimulator::load(std::istream& is) {
+  std::string line, func;
+  bool is_spill = false, in_text = false;
+  auto align = [&](int bytes) {
+    m_data_end = (m_data_end + bytes - 1) / bytes * bytes;
+    m_memory.resize(m_data_end);
+  };
+  auto emit = [&](uint32_t val) {
+    m_memory.resize(m_data_end + 4);
+    memcpy(m_memory.data() + m_data_end, &val, 4);
+    m_data_end += 4;
+  };
+  while (std::getline(is, line)) {
+    auto comment = line.find('@');
+    if (comment != std::string::npos) {
+      // the exporter marks spill code on the line before it
+      is_spill |= line.find("spill", comment) != std::string::npos;
+      line = line.substr(0, comment);
+    }
+    auto begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos) continue;
+    auto end = line.find_last_not_of(" \t");
+    line = line.substr(begin, end - begin + 1);
+    auto space = line.find_first_of(" \t");
+    std::string head = line.substr(0, space);
+    std::string rest
+        = space == std::string::npos ? "" : line.substr(space + 1);
+
+    if (head.back() == ':') {
+      // labels in .text name both the next instruction and the data after
+      // them, like the path of the profile dump
+      std::string label = head.substr(0, head.size() - 1);
+      m_data_labels[label] = m_data_end;
+      if (!in_text) continue;
+      m_text_labels[label] = m_insts.size();
+      if (label.substr(0, 2) != ".L") func = label;
+      if (!m_blocks.empty()) m_blocks.back().m_end = m_insts.size();
+      m_blocks.push_back({label, func, (int)m_insts.size(), 0});
+      continue;
+    }
+    if (head[0] == '.') {
+      if (head == ".data" || head == ".bss" || head == ".text") {
+        in_text = head == ".text";
+      } else if (head == ".word" || head == ".float") {
+        for (auto& val : splitOperands(rest)) {
+          if (head == ".word")
+            emit(std::stol(val, nullptr, 0));
+          else
+            emit(floatBits(std::stof(val)));
+        }
+      } else if (head == ".space") {
+        m_data_end += std::stoi(rest);
+        m_memory.resize(m_data_end);
+      } else if (head == ".asciz") {
+        std::string str = rest.substr(1, rest.rfind('"') - 1);
+        m_memory.insert(m_memory.end(), str.begin(), str.end());
+        m_memory.push_back(0);
+        m_data_end += str.size() + 1;
+      } else if (head == ".align" || head == ".p2align") {
+        align(1 << std::stoi(rest));
+      }
+      continue;
+    }
+    parseInst(head, rest, is_spill);
+    is_spill = false;
+  }
+  if (!m_blocks.empty()) m_blocks.back().m_end = m_insts.size();
+}
+
+void ARMSimulator::parseInst(const std::string& mnemonic,
+                             const std::string& operands, bool is_spill) {
+  SimInst inst;
+  inst.m_set_flag = false;
+  inst.m_is_spill = is_spill;
+  inst.m_rd = inst.m_rn = inst.m_rm = inst.m_ra = inst.m_rs = -1;
+  inst.m_imm = 0;
+  inst.m_has_shift = false;
+  inst.m_shift = SimOp::LSL;
+  inst.m_shift_amt = 0;
+  inst.m_mode = 0;
+  inst.m_target = -1;
+  inst.m_block = m_blocks.size() - 1;
+
+  auto dot = mnemonic.find('.');
+  std::string name = mnemonic.substr(0, dot);
+  std::string suffix = dot == std::string::npos ? "" : mnemonic.substr(dot);
+
+  // the longest mnemonic followed by S, a condition or both, the addressing
+  // mode of LDM and the like goes before the condition
+  bool found = false;
+  std::string op_name;
+  for (auto& [str, op] : g_mnemonics) {
+    if (name.compare(0, str.size(), str) || str.size() <= op_name.size())
+      continue;
+    std::string rest = name.substr(str.size());
+    int mode = 0;
+    bool multiple = op == SimOp::LDM || op == SimOp::STM || op == SimOp::VLDM
+                    || op == SimOp::VSTM;
+    if (multiple && (rest.substr(0, 2) == "IB" || rest.substr(0, 2) == "DB")) {
+      mode = rest[0] == 'I' ? 1 : -1;
+      rest = rest.substr(2);
+    }
+    bool set_flag = false;
+    CondType cond;
+    if (!parseCond(rest, cond)) {
+      if (rest[0] != 'S' || !setsFlagOptionally(op)
+          || !parseCond(rest.substr(1), cond))
+        continue;
+      set_flag = true;
+    }
+    found = true;
+    op_name = str;
+    inst.m_op = op;
+    inst.m_cond = cond;
+    inst.m_set_flag = set_flag;
+    inst.m_mode = mode;
+  }
+  if (!found) throw MyException("unknown instruction " + mnemonic);
+
+  auto ops = splitOperands(operands);
+  auto reg = [&](int i) {
+    int r = i < ops.size() ? parseReg(ops[i]) : -1;
+    if (r == -1) throw MyException("bad operands of " + mnemonic);
+    return r;
+  };
+  auto imm = [&](const std::string& str) -> int {
+    if (str[0] != '#') throw MyException("bad operands of " + mnemonic);
+    std::string val = str.substr(1);
+    if (val.find('.') != std::string::npos) return floatBits(std::stof(val));
+    return std::stol(val, nullptr, 0);
+  };
+  // Rm or #imm, then an optional shift of Rm
+  auto parseOperand2 = [&](int i) {
+    if (i >= ops.size()) throw MyException("bad operands of " + mnemonic);
+    if (ops[i][0] == '#') {
+      inst.m_imm = imm(ops[i]);
+    } else {
+      inst.m_rm = reg(i);
+    }
+    if (i + 1 < ops.size()) {
+      std::istringstream iss(ops[i + 1]);
+      std::string kind, amt;
+      iss >> kind >> amt;
+      bool valid = false;
+      for (auto op : {SimOp::LSL, SimOp::LSR, SimOp::ASR, SimOp::ROR}) {
+        for (auto& [str, o] : g_mnemonics) {
+          if (o != op || str != kind) continue;
+          inst.m_shift = op;
+          valid = true;
+        }
+      }
+      if (!valid || inst.m_rm == -1)
+        throw MyException("bad operands of " + mnemonic);
+      inst.m_has_shift = true;
+      inst.m_shift_amt = imm(amt);
+    }
+  };
+  // [Rn, #imm] or [Rn, Rm, shift]
+  auto memory = [&](int i) {
+    auto& str = ops.at(i);
+    if (str.front() != '[' || str.back() != ']')
+      throw MyException("bad operands of " + mnemonic);
+    auto addr = splitOperands(str.substr(1, str.size() - 2));
+    ops.erase(ops.begin() + i);
+    ops.insert(ops.begin() + i, addr.begin(), addr.end());
+    inst.m_rn = reg(i);
+    if (i + 1 < ops.size()) parseOperand2(i + 1);
+  };
+  auto regList = [&](int i) {
+    auto& str = ops.at(i);
+    if (str.front() != '{' || str.back() != '}')
+      throw MyException("bad operands of " + mnemonic);
+    for (auto& r : splitOperands(str.substr(1, str.size() - 2))) {
+      inst.m_regs.push_back(parseReg(r));
+      if (inst.m_regs.back() == -1)
+        throw MyException("bad operands of " + mnemonic);
+    }
+  };
+
+  switch (inst.m_op) {
+    case SimOp::LDR:
+    case SimOp::STR:
+    case SimOp::VLDR:
+    case SimOp::VSTR:
+      inst.m_rd = reg(0);
+      memory(1);
+      break;
+    case SimOp::LDRD:
+    case SimOp::STRD:
+      inst.m_regs = {reg(0), reg(1)};
+      memory(2);
+      break;
+    case SimOp::LDM:
+    case SimOp::STM:
+    case SimOp::VLDM:
+    case SimOp::VSTM:
+      inst.m_rn = reg(0);
+      regList(1);
+      break;
+    case SimOp::PUSH:
+    case SimOp::POP:
+    case SimOp::VPUSH:
+    case SimOp::VPOP:
+      regList(0);
+      break;
+    case SimOp::MOVW:
+    case SimOp::MOVT: {
+      inst.m_rd = reg(0);
+      auto& str = ops.at(1);
+      if (str.compare(0, 3, "#:l") == 0 || str.compare(0, 3, "#:u") == 0) {
+        // #:lower16:label, resolved after loading
+        inst.m_label = str.substr(str.find(':', 2) + 1);
+        inst.m_mode = str[2] == 'u';
+      } else {
+        inst.m_imm = imm(str);
+      }
+      break;
+    }
+    case SimOp::MOV:
+    case SimOp::MVN:
+    case SimOp::VMOV:
+    case SimOp::VNEG:
+    case SimOp::VCVT:
+      inst.m_rd = reg(0);
+      parseOperand2(1);
+      if (inst.m_op == SimOp::VCVT) inst.m_mode = suffix == ".F32.S32";
+      break;
+    case SimOp::LSL:
+    case SimOp::LSR:
+    case SimOp::ASR:
+    case SimOp::ROR:
+      // a MOV with the shift
+      inst.m_rd = reg(0);
+      inst.m_rm = reg(1);
+      inst.m_has_shift = true;
+      inst.m_shift = inst.m_op;
+      if (ops.at(2)[0] == '#')
+        inst.m_shift_amt = imm(ops[2]);
+      else
+        inst.m_rs = reg(2);
+      break;
+    case SimOp::CMP:
+    case SimOp::TST:
+    case SimOp::VCMP:
+      inst.m_rn = reg(0);
+      parseOperand2(1);
+      break;
+    case SimOp::MUL:
+    case SimOp::SMMUL:
+    case SimOp::SDIV:
+    case SimOp::VADD:
+    case SimOp::VSUB:
+    case SimOp::VMUL:
+    case SimOp::VDIV:
+    case SimOp::VMLA:
+    case SimOp::VMLS:
+      inst.m_rd = reg(0);
+      inst.m_rn = reg(1);
+      inst.m_rm = reg(2);
+      break;
+    case SimOp::MLA:
+    case SimOp::MLS:
+    case SimOp::SMMLA:
+    case SimOp::SMMLS:
+      inst.m_rd = reg(0);
+      inst.m_rn = reg(1);
+      inst.m_rm = reg(2);
+      inst.m_ra = reg(3);
+      break;
+    case SimOp::B:
+    case SimOp::BL:
+      inst.m_label = ops.at(0);
+      break;
+    case SimOp::BX:
+      inst.m_rm = reg(0);
+      break;
+    case SimOp::SVC:
+    case SimOp::VMRS:
+      break;
+    default:
+      // the data-processing ones
+      inst.m_rd = reg(0);
+      inst.m_rn = reg(1);
+      parseOperand2(2);
+      break;
+  }
+  setDependencies(inst);
+  m_insts.push_back(std::move(inst));
+}
+
+// the registers read and written, for the operands to be waited for
+void ARMSimulator::setDependencies(SimInst& inst) {
+  auto& srcs = inst.m_srcs;
+  auto& dsts = inst.m_dsts;
+  for (int r : {inst.m_rn, inst.m_rm, inst.m_ra, inst.m_rs}) {
+    if (r != -1) srcs.push_back(r);
+  }
+  switch (inst.m_op) {
+    case SimOp::STR:
+    case SimOp::VSTR:
+      srcs.push_back(inst.m_rd);
+      break;
+    case SimOp::LDRD:
+    case SimOp::LDM:
+    case SimOp::VLDM:
+      dsts = inst.m_regs;
+      break;
+    case SimOp::STRD:
+    case SimOp::STM:
+    case SimOp::VSTM:
+      srcs.insert(srcs.end(), inst.m_regs.begin(), inst.m_regs.end());
+      break;
+    case SimOp::PUSH:
+    case SimOp::VPUSH:
+      srcs.insert(srcs.end(), inst.m_regs.begin(), inst.m_regs.end());
+      srcs.push_back(13);
+      dsts.push_back(13);
+      break;
+    case SimOp::POP:
+    case SimOp::VPOP:
+      dsts = inst.m_regs;
+      srcs.push_back(13);
+      dsts.push_back(13);
+      break;
+    case SimOp::BL:
+      // the caller-saved registers
+      for (int r : {0, 1, 2, 3, 12, 14}) dsts.push_back(r);
+      for (int r = 16; r < 32; r++) dsts.push_back(r);
+      break;
+    case SimOp::SVC:
+      srcs = {0, 1, 2, 7};
+      dsts.push_back(0);
+      break;
+    case SimOp::CMP:
+    case SimOp::TST:
+    case SimOp::B:
+    case SimOp::BX:
+      break;
+    case SimOp::VCMP:
+      dsts.push_back(FPSCR);
+      break;
+    case SimOp::VMRS:
+      srcs.push_back(FPSCR);
+      break;
+    case SimOp::MOVT:
+    case SimOp::VMLA:
+    case SimOp::VMLS:
+      srcs.push_back(inst.m_rd);
+      dsts.push_back(inst.m_rd);
+      break;
+    default:
+      dsts.push_back(inst.m_rd);
+      break;
+  }
+  if (inst.m_set_flag || inst.m_op == SimOp::CMP || inst.m_op == SimOp::TST
+      || inst.m_op == SimOp::VMRS)
+    dsts.push_back(FLAGS);
+  // a conditional instruction keeps the old values when not executed
+  if (inst.m_cond != CondType::NONE) {
+    srcs.insert(srcs.end(), dsts.begin(), dsts.end());
+    srcs.push_back(FLAGS);
+  }
+
+  inst.m_latency = latencyOf(inst.m_op, inst.m_has_shift);
+  inst.m_issue = 1;
+  switch (inst.m_op) {
+    case SimOp::LDM:
+    case SimOp::STM:
+    case SimOp::VLDM:
+    case SimOp::VSTM:
+    case SimOp::PUSH:
+    case SimOp::POP:
+    case SimOp::VPUSH:
+    case SimOp::VPOP:
+      inst.m_issue = std::max(1, ((int)inst.m_regs.size() + 1) / 2);
+      break;
+    default:
+      break;
+  }
+}
+
+// branch targets and the addresses of data labels, known after loading
+void ARMSimulator::resolve() {
+  for (auto& inst : m_insts) {
+    if (inst.m_op == SimOp::B || inst.m_op == SimOp::BL) {
+      // the sylib functions have no label, a B to them is a tail call
+      auto found = m_text_labels.find(inst.m_label);
+      if (found != m_text_labels.end()) inst.m_target = found->second;
+    } else if (!inst.m_label.empty()) {
+      inst.m_imm = dataLabel(inst.m_label) >> (inst.m_mode ? 16 : 0);
+    }
+  }
+}
+
+int ARMSimulator::dataLabel(const std::string& label) {
+  auto found = m_data_labels.find(label);
+  if (found == m_data_labels.end())
+    throw MyException("unknown label " + label);
+  return found->second;
+}
+
+bool ARMSimulator::condPassed(CondType cond) {
+  switch (cond) {
+    case CondType::NONE:
+      return true;
+    case CondType::EQ:
+      return m_z;
+    case CondType::NE:
+      return !m_z;
+    case CondType::CS:
+      return m_c;
+    case CondType::CC:
+      return !m_c;
+    case CondType::MI:
+      return m_n;
+    case CondType::PL:
+      return !m_n;
+    case CondType::VS:
+      return m_v;
+    case CondType::VC:
+      return !m_v;
+    case CondType::HI:
+      return m_c && !m_z;
+    case CondType::LS:
+      return !m_c || m_z;
+    case CondType::GE:
+      return m_n == m_v;
+    case CondType::LT:
+      return m_n != m_v;
+    case CondType::GT:
+      return !m_z && m_n == m_v;
+    case CondType::LE:
+      return m_z || m_n != m_v;
+  }
+  return true;
+}
+
+uint32_t ARMSimulator::operand2(const SimInst& inst) {
+  if (inst.m_rm == -1) return inst.m_imm;
+  uint32_t val = m_regs[inst.m_rm];
+  if (!inst.m_has_shift) return val;
+  int amt = inst.m_rs == -1 ? inst.m_shift_amt : m_regs[inst.m_rs] & 0xff;
+  return shiftValue(inst.m_shift, val, amt);
+}
+
+uint32_t ARMSimulator::address(const SimInst& inst) {
+  return m_regs[inst.m_rn] + operand2(inst);
+}
+
+uint32_t ARMSimulator::addSub(uint32_t a, uint32_t b, bool carry,
+                              bool set_flag) {
+  uint64_t sum = (uint64_t)a + b + carry;
+  uint32_t ret = sum;
+  if (set_flag) {
+    setNZ(ret);
+    m_c = sum >> 32;
+    m_v = ((a ^ ret) & (b ^ ret)) >> 31;
+  }
+  return ret;
+}
+
+void ARMSimulator::setNZ(uint32_t val) {
+  m_n = val >> 31;
+  m_z = val == 0;
+}
+
+uint32_t ARMSimulator::read(uint32_t addr) {
+  if (addr < DATA_BASE || addr > m_memory.size() - 4 || addr % 4) {
+    std::ostringstream oss;
+    oss << "bad load from 0x" << std::hex << addr;
+    throw MyException(oss.str());
+  }
+  uint32_t val;
+  memcpy(&val, m_memory.data() + addr, 4);
+  return val;
+}
+
+void ARMSimulator::write(uint32_t addr, uint32_t val) {
+  if (addr < DATA_BASE || addr > m_memory.size() - 4 || addr % 4) {
+    std::ostringstream oss;
+    oss << "bad store to 0x" << std::hex << addr;
+    throw MyException(oss.str());
+  }
+  memcpy(m_memory.data() + addr, &val, 4);
+}
+
+void ARMSimulator::callSylib(const std::string& name) {
+  uint32_t* r = m_regs;
+  uint32_t* s = m_regs + 16;
+  bool ret_int = true, ret_float = false;
+  auto readFloat = [&]() {
+    std::string str;
+    if (!(std::cin >> str)) return 0.0f;
+    return std::strtof(str.c_str(), nullptr);
+  };
+  auto readInt = [&]() {
+    int val = 0;
+    std::cin >> val;
+    return val;
+  };
+  if (name == "getint") {
+    r[0] = readInt();
+  } else if (name == "getch") {
+    r[0] = std::cin.get();
+  } else if (name == "getfloat") {
+    s[0] = floatBits(readFloat());
+    ret_int = false;
+    ret_float = true;
+  } else if (name == "getarray" || name == "getfarray") {
+    int n = readInt();
+    for (int i = 0; i < n; i++) {
+      uint32_t val
+          = name == "getarray" ? readInt() : floatBits(readFloat());
+      write(r[0] + i * 4, val);
+    }
+    r[0] = n;
+  } else if (name == "putint") {
+    std::cout << (int)r[0];
+    ret_int = false;
+  } else if (name == "putch") {
+    std::cout << (char)r[0];
+    ret_int = false;
+  } else if (name == "putfloat") {
+    std::cout << std::hexfloat << bitsFloat(s[0]) << std::defaultfloat;
+    ret_int = false;
+  } else if (name == "putarray" || name == "putfarray") {
+    int n = r[0];
+    std::cout << n << ":";
+    for (int i = 0; i < n; i++) {
+      uint32_t val = read(r[1] + i * 4);
+      if (name == "putarray")
+        std::cout << " " << (int)val;
+      else
+        std::cout << " " << std::hexfloat << bitsFloat(val)
+                  << std::defaultfloat;
+    }
+    std::cout << std::endl;
+    ret_int = false;
+  } else if (name == "memset") {
+    if (r[2]) {
+      read(r[0]);
+      read(r[0] + r[2] - 4);
+    }
+    memset(m_memory.data() + r[0], r[1], r[2]);
+  } else if (name == "_sysy_starttime") {
+    m_timer_line = r[0];
+    m_timer_start = m_cycles;
+    ret_int = false;
+  } else if (name == "_sysy_stoptime") {
+    m_timers.emplace_back(m_timer_line, r[0], m_cycles - m_timer_start);
+    ret_int = false;
+  } else {
+    throw MyException("call to unknown function " + name);
+  }
+  // the caller-saved registers hold garbage after a call, so that code
+  // relying on them fails here too
+  for (int i = ret_int; i < 4; i++) r[i] = CLOBBER;
+  r[12] = CLOBBER;
+  for (int i = ret_float; i < 16; i++) s[i] = CLOBBER;
+}
+
+// the system calls of the profile dump: open, write and close
+void ARMSimulator::systemCall() {
+  uint32_t* r = m_regs;
+  switch (r[7]) {
+    case 5: {
+      std::string path;
+      for (uint32_t addr = r[0]; addr < m_memory.size() && m_memory[addr];
+           addr++)
+        path += m_memory[addr];
+      std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+      if (!ofs) {
+        r[0] = -1;
+        break;
+      }
+      int fd = 3 + m_files.size();
+      m_files[fd] = path;
+      r[0] = fd;
+      break;
+    }
+    case 4: {
+      auto found = m_files.find(r[0]);
+      if (found == m_files.end()) {
+        r[0] = -1;
+        break;
+      }
+      if (r[2]) {
+        read(r[1]);
+        read(r[1] + r[2] - 4);
+      }
+      std::ofstream ofs(found->second, std::ios::binary | std::ios::app);
+      ofs.write((const char*)m_memory.data() + r[1], r[2]);
+      r[0] = r[2];
+      break;
+    }
+    case 6:
+      r[0] = m_files.erase(r[0]) ? 0 : -1;
+      break;
+    default:
+      throw MyException("unknown system call " + std::to_string(r[7]));
+  }
+}
+
+int ARMSimulator::run() {
+  auto found = m_text_labels.find("main");
+  if (found == m_text_labels.end()) throw MyException("no main");
+  std::fill(m_regs, m_regs + REG_NUM, 0);
+  std::fill(m_ready, m_ready + REG_NUM, 0);
+  m_n = m_z = m_c = m_v = false;
+  m_fn = m_fz = m_fc = m_fv = false;
+  m_regs[13] = m_memory.size();
+  m_regs[14] = EXIT_ADDR;
+  uint32_t* r = m_regs;
+
+  int pc = found->second;
+  // continues at a code address, or stops at EXIT_ADDR
+  auto jump = [&](uint32_t addr) {
+    if (addr == EXIT_ADDR) return -1;
+    if (addr < TEXT_BASE || (addr - TEXT_BASE) / 4 >= m_insts.size()) {
+      std::ostringstream oss;
+      oss << "jump to 0x" << std::hex << addr;
+      throw MyException(oss.str());
+    }
+    return (int)((addr - TEXT_BASE) / 4);
+  };
+  while (pc != -1) {
+    if (pc >= m_insts.size()) throw MyException("ran out of the code");
+    auto& inst = m_insts[pc];
+    uint64_t issue = m_cycles + 1;
+    for (int src : inst.m_srcs) issue = std::max(issue, m_ready[src]);
+    issue += inst.m_issue - 1;
+    for (int dst : inst.m_dsts) m_ready[dst] = issue + inst.m_latency;
+    m_inst_cycles[pc] += issue - m_cycles;
+    m_inst_counts[pc]++;
+    m_cycles = issue;
+    m_steps++;
+
+    int next = pc + 1;
+    if (!condPassed(inst.m_cond)) {
+      pc = next;
+      continue;
+    }
+    uint32_t& rd = m_regs[inst.m_rd == -1 ? 0 : inst.m_rd];
+    uint32_t rn = m_regs[inst.m_rn == -1 ? 0 : inst.m_rn];
+    switch (inst.m_op) {
+      case SimOp::LDR:
+      case SimOp::VLDR:
+        rd = read(address(inst));
+        m_loads++;
+        m_spill_loads += inst.m_is_spill;
+        break;
+      case SimOp::STR:
+      case SimOp::VSTR:
+        write(address(inst), rd);
+        m_stores++;
+        m_spill_stores += inst.m_is_spill;
+        break;
+      case SimOp::LDRD:
+        m_regs[inst.m_regs[0]] = read(address(inst));
+        m_regs[inst.m_regs[1]] = read(address(inst) + 4);
+        m_loads++;
+        break;
+      case SimOp::STRD:
+        write(address(inst), m_regs[inst.m_regs[0]]);
+        write(address(inst) + 4, m_regs[inst.m_regs[1]]);
+        m_stores++;
+        break;
+      case SimOp::LDM:
+      case SimOp::STM:
+      case SimOp::VLDM:
+      case SimOp::VSTM: {
+        int n = inst.m_regs.size();
+        uint32_t addr = rn + (inst.m_mode == 1    ? 4
+                              : inst.m_mode == -1 ? -4 * n
+                                                  : 0);
+        bool is_load = inst.m_op == SimOp::LDM || inst.m_op == SimOp::VLDM;
+        for (int i = 0; i < n; i++, addr += 4) {
+          if (is_load)
+            m_regs[inst.m_regs[i]] = read(addr);
+          else
+            write(addr, m_regs[inst.m_regs[i]]);
+        }
+        (is_load ? m_loads : m_stores)++;
+        break;
+      }
+      case SimOp::PUSH:
+      case SimOp::VPUSH: {
+        r[13] -= 4 * inst.m_regs.size();
+        uint32_t addr = r[13];
+        for (int reg : inst.m_regs) {
+          write(addr, m_regs[reg]);
+          addr += 4;
+        }
+        m_stores++;
+        break;
+      }
+      case SimOp::POP:
+      case SimOp::VPOP: {
+        uint32_t addr = r[13];
+        r[13] += 4 * inst.m_regs.size();
+        for (int reg : inst.m_regs) {
+          if (reg == 15)
+            next = jump(read(addr));
+          else
+            m_regs[reg] = read(addr);
+          addr += 4;
+        }
+        m_loads++;
+        break;
+      }
+      case SimOp::MOV:
+      case SimOp::LSL:
+      case SimOp::LSR:
+      case SimOp::ASR:
+      case SimOp::ROR:
+      case SimOp::VMOV:
+        rd = operand2(inst);
+        if (inst.m_set_flag) setNZ(rd);
+        break;
+      case SimOp::MVN:
+        rd = ~operand2(inst);
+        if (inst.m_set_flag) setNZ(rd);
+        break;
+      case SimOp::MOVW:
+        rd = inst.m_imm & 0xffff;
+        break;
+      case SimOp::MOVT:
+        rd = (rd & 0xffff) | (inst.m_imm << 16);
+        break;
+      case SimOp::B:
+        if (inst.m_target != -1) {
+          next = inst.m_target;
+          break;
+        }
+        m_calls++;
+        callSylib(inst.m_label);
+        next = jump(r[14]);
+        break;
+      case SimOp::BL:
+        r[14] = TEXT_BASE + 4 * next;
+        m_calls++;
+        if (inst.m_target != -1)
+          next = inst.m_target;
+        else
+          callSylib(inst.m_label);
+        break;
+      case SimOp::BX:
+        next = jump(m_regs[inst.m_rm]);
+        break;
+      case SimOp::SVC:
+        systemCall();
+        break;
+      case SimOp::ADD:
+        rd = addSub(rn, operand2(inst), false, inst.m_set_flag);
+        break;
+      case SimOp::SUB:
+        rd = addSub(rn, ~operand2(inst), true, inst.m_set_flag);
+        break;
+      case SimOp::RSB:
+        rd = addSub(operand2(inst), ~rn, true, inst.m_set_flag);
+        break;
+      case SimOp::CMP:
+        addSub(rn, ~operand2(inst), true, true);
+        break;
+      case SimOp::TST:
+        setNZ(rn & operand2(inst));
+        break;
+      case SimOp::AND:
+      case SimOp::ORR:
+      case SimOp::EOR:
+      case SimOp::BIC: {
+        uint32_t b = operand2(inst);
+        rd = inst.m_op == SimOp::AND   ? rn & b
+             : inst.m_op == SimOp::ORR ? rn | b
+             : inst.m_op == SimOp::EOR ? rn ^ b
+                                       : rn & ~b;
+        if (inst.m_set_flag) setNZ(rd);
+        break;
+      }
+      case SimOp::MUL:
+      case SimOp::MLA:
+      case SimOp::MLS: {
+        uint32_t prod = rn * m_regs[inst.m_rm];
+        rd = inst.m_op == SimOp::MUL   ? prod
+             : inst.m_op == SimOp::MLA ? m_regs[inst.m_ra] + prod
+                                       : m_regs[inst.m_ra] - prod;
+        if (inst.m_set_flag) setNZ(rd);
+        break;
+      }
+      case SimOp::SMMUL:
+      case SimOp::SMMLA:
+      case SimOp::SMMLS: {
+        int64_t prod = (int64_t)(int32_t)rn * (int32_t)m_regs[inst.m_rm];
+        uint64_t acc = inst.m_op == SimOp::SMMUL
+                           ? 0
+                           : (uint64_t)m_regs[inst.m_ra] << 32;
+        rd = (inst.m_op == SimOp::SMMLS ? acc - prod : acc + prod) >> 32;
+        break;
+      }
+      case SimOp::SDIV: {
+        int32_t a = rn, b = m_regs[inst.m_rm];
+        if (b == 0)
+          rd = 0;
+        else if (b == -1)
+          rd = -(uint32_t)a;
+        else
+          rd = a / b;
+        break;
+      }
+      case SimOp::VADD:
+      case SimOp::VSUB:
+      case SimOp::VMUL:
+      case SimOp::VDIV:
+      case SimOp::VMLA:
+      case SimOp::VMLS: {
+        float a = bitsFloat(rn), b = bitsFloat(m_regs[inst.m_rm]);
+        float d = bitsFloat(rd);
+        switch (inst.m_op) {
+          case SimOp::VADD:
+            d = a + b;
+            break;
+          case SimOp::VSUB:
+            d = a - b;
+            break;
+          case SimOp::VMUL:
+            d = a * b;
+            break;
+          case SimOp::VDIV:
+            d = a / b;
+            break;
+          default: {
+            // not fused, the product is rounded first
+            volatile float prod = a * b;
+            d = inst.m_op == SimOp::VMLA ? d + prod : d - prod;
+            break;
+          }
+        }
+        rd = floatBits(d);
+        break;
+      }
+      case SimOp::VNEG:
+        rd = operand2(inst) ^ 0x80000000;
+        break;
+      case SimOp::VCMP: {
+        float a = bitsFloat(rn), b = bitsFloat(operand2(inst));
+        m_fn = a < b;
+        m_fz = a == b;
+        m_fc = !(a < b);
+        m_fv = std::isnan(a) || std::isnan(b);
+        break;
+      }
+      case SimOp::VMRS:
+        m_n = m_fn;
+        m_z = m_fz;
+        m_c = m_fc;
+        m_v = m_fv;
+        break;
+      case SimOp::VCVT: {
+        uint32_t src = operand2(inst);
+        if (inst.m_mode) {
+          rd = floatBits((float)(int32_t)src);
+          break;
+        }
+        // toward zero, saturating
+        float val = bitsFloat(src);
+        if (std::isnan(val))
+          rd = 0;
+        else if (val >= 2147483648.0f)
+          rd = std::numeric_limits<int32_t>::max();
+        else if (val < -2147483648.0f)
+          rd = std::numeric_limits<int32_t>::min();
+        else
+          rd = (int32_t)val;
+        break;
+      }
+    }
+    if (next != pc + 1) {
+      m_taken_branches++;
+      m_cycles += TAKEN_BRANCH_PENALTY;
+      m_inst_cycles[pc] += TAKEN_BRANCH_PENALTY;
+    }
+    pc = next;
+  }
+  std::cout.flush();
+  return r[0] & 0xff;
+}
+
+void ARMSimulator::report(std::ostream& os, int top) {
+  os << "[sim] " << m_steps << " instructions, " << m_cycles << " cycles";
+  if (m_steps)
+    os << ", " << std::fixed << std::setprecision(2)
+       << (double)m_cycles / m_steps << " CPI";
+  os << std::endl;
+  os << "[sim] " << m_loads << " loads (" << m_spill_loads << " spill), "
+     << m_stores << " stores (" << m_spill_stores << " spill)" << std::endl;
+  os << "[sim] " << m_taken_branches << " taken branches, " << m_calls
+     << " calls" << std::endl;
+  for (auto& [start, stop, cycles] : m_timers) {
+    os << "[sim] timer " << start << "-" << stop << ": " << cycles
+       << " cycles" << std::endl;
+  }
+
+  std::vector<std::tuple<uint64_t, uint64_t, const SimBlock*>> blocks;
+  for (auto& block : m_blocks) {
+    if (block.m_begin == block.m_end) continue;
+    uint64_t insts = 0, cycles = 0;
+    for (int i = block.m_begin; i < block.m_end; i++) {
+      insts += m_inst_counts[i];
+      cycles += m_inst_cycles[i];
+    }
+    if (insts) blocks.emplace_back(cycles, insts, &block);
+  }
+  std::stable_sort(blocks.begin(), blocks.end(), [](auto& a, auto& b) {
+    return std::get<0>(a) > std::get<0>(b);
+  });
+  if (blocks.size() > top) blocks.resize(top);
+  if (!blocks.empty()) os << "[sim] hottest blocks:" << std::endl;
+  for (auto& [cycles, insts, block] : blocks) {
+    os << "[sim]   " << block->m_label;
+    if (block->m_label != block->m_func) os << " (" << block->m_func << ")";
+    os << ": " << m_inst_counts[block->m_begin] << " x, " << insts
+       << " instructions, " << cycles << " cycles, " << std::fixed
+       << std::setprecision(1) << 100.0 * cycles / m_cycles << "%"
+       << std::endl;
+  }
+}
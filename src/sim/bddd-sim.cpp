@@ -0,0 +1,49 @@
+#include <getopt.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "exceptions.h"
+#include "sim/arm-simulator.h"
+
+static const struct option long_options[]
+    = {{"top", required_argument, nullptr, 'n'},
+       {nullptr, no_argument, nullptr, 0}};
+
+int main(int argc, char* argv[]) {
+  int ch;
+  // the hottest blocks reported
+  int top = 10;
+  while ((ch = getopt_long(argc, argv, "n:", long_options, NULL)) != -1) {
+    switch (ch) {
+      case 'n':
+        top = std::stoi(optarg);
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  if (optind == argc) {
+    std::cerr << "no input file" << std::endl;
+    return 1;
+  }
+  std::ifstream ifs(argv[optind]);
+  if (!ifs) {
+    std::cerr << "can't open " << argv[optind] << std::endl;
+    return 1;
+  }
+
+  std::ios::sync_with_stdio(false);
+  int exit_code;
+  try {
+    ARMSimulator simulator(ifs);
+    exit_code = simulator.run();
+    simulator.report(std::cerr, top);
+  } catch (MyException& e) {
+    std::cout.flush();
+    std::cerr << "exception during simulation: " << e.Msg() << std::endl;
+    return 1;
+  }
+  return exit_code;
+}